@@ -71,4 +71,33 @@ template<class C> class Random{
 
 };
 
+// Counter-based generator for passes run on several threads: the n-th
+// number of a stream depends only on its key and n, never on rand() or on
+// other streams, so it is the same whichever thread draws it.
+class StreamRandom{
+  unsigned long key;
+  unsigned long count;
+
+  static unsigned long mix(unsigned long z){
+    //finalizer of SplitMix64
+    z=(z^(z>>30))*0xbf58476d1ce4e5b9UL;
+    z=(z^(z>>27))*0x94d049bb133111ebUL;
+    return z^(z>>31);
+  }
+
+ public:
+
+  StreamRandom(const unsigned long a, const unsigned long b, const unsigned long c){
+    key=mix(mix(mix(a)+b)+c);
+    count=0;
+  }
+
+  //0.0 is possible, 1.0 is not, as for Random<double>
+  double rnum(){
+    count++;
+    return (mix(key+0x9e3779b97f4a7c15UL*count)>>11)*(1.0/9007199254740992.0);
+  }
+
+};
+
 #endif
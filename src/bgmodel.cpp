@@ -1,659 +1,778 @@
+#include <pthread.h>
 #include "bgmodel.h"
+#include "fasta.h"
 
-BGModel::BGModel(const Seqset& s, const int ord) :
+const int BGModel::MAX_ORDER;
+const int BGModel::DENSE_ORDER;
+const int BGModel::LAMBDA;
+const long BGModel::CHUNK_BASES;
+
+BGModel::BGModel(const Seqset& s, const int ord, const int nthreads, const bool lean_scores) :
 seqset(s),
 total_seq_len(0),
 order(ord),
 gc_genome(0),
 gc(seqset.num_seqs()),
-model0(4),
-model1(16),
-model2(64),
-model3(256),
-model4(1024),
-model5(4096),
-wbgscores(seqset.num_seqs()),
-cbgscores(seqset.num_seqs()),
-cumulscores(seqset.num_seqs()) {
-	const vector<vector <char> >& seq = seqset.seq();
+wbgscores(NULL),
+cbgscores(NULL),
+wcumul(NULL),
+ccumul(NULL),
+wbg_store(0),
+cbg_store(0),
+wcumul_store(0),
+ccumul_store(0),
+lean(lean_scores) {
+	if(order < 0 || order > MAX_ORDER) {
+		cerr << "Background model order must be between 0 and " << MAX_ORDER << "\n";
+		exit(1);
+	}
+	set_functions();
+	init_models();
+	calc_gc();
+	count_all(max(nthreads, 1));
+	for(int i = 0; i <= order; i++) {
+		(*this.*train_background[i])();
+	}
+	calc_scores();
+}
+
+BGModel::BGModel(const Seqset& s, istream& tables, const bool lean_scores) :
+seqset(s),
+total_seq_len(0),
+order(0),
+gc_genome(0),
+gc(seqset.num_seqs()),
+wbgscores(NULL),
+cbgscores(NULL),
+wcumul(NULL),
+ccumul(NULL),
+wbg_store(0),
+cbg_store(0),
+wcumul_store(0),
+ccumul_store(0),
+lean(lean_scores) {
+	set_functions();
+	calc_gc();
+	read_tables(tables);
+	calc_scores();
+}
+
+BGModel::BGModel(const Seqset& s, istream& tables, const float* wbg, const float* cbg,
+		const double* wcum, const double* ccum) :
+seqset(s),
+total_seq_len(0),
+order(0),
+gc_genome(0),
+gc(seqset.num_seqs()),
+wbgscores(wbg),
+cbgscores(cbg),
+wcumul(wcum),
+ccumul(ccum),
+lean(false) {
+	set_functions();
+	calc_gc();
+	read_tables(tables);
+}
+
+void BGModel::set_functions() {
+	count_background[0] = &BGModel::count_kmers<0>;
+	count_background[1] = &BGModel::count_kmers<1>;
+	count_background[2] = &BGModel::count_kmers<2>;
+	count_background[3] = &BGModel::count_kmers<3>;
+	count_background[4] = &BGModel::count_kmers<4>;
+	count_background[5] = &BGModel::count_kmers<5>;
+	count_background[6] = &BGModel::count_kmers<6>;
+	count_background[7] = &BGModel::count_kmers<7>;
+	count_background[8] = &BGModel::count_kmers<8>;
+	count_background[9] = &BGModel::count_kmers<9>;
+	count_background[10] = &BGModel::count_kmers<10>;
+	
+	train_background[0] = &BGModel::train_order<0>;
+	train_background[1] = &BGModel::train_order<1>;
+	train_background[2] = &BGModel::train_order<2>;
+	train_background[3] = &BGModel::train_order<3>;
+	train_background[4] = &BGModel::train_order<4>;
+	train_background[5] = &BGModel::train_order<5>;
+	train_background[6] = &BGModel::train_interpolated<6>;
+	train_background[7] = &BGModel::train_interpolated<7>;
+	train_background[8] = &BGModel::train_interpolated<8>;
+	train_background[9] = &BGModel::train_interpolated<9>;
+	train_background[10] = &BGModel::train_interpolated<10>;
+	
+	calc_bg_scores[0] = &BGModel::score_order<0>;
+	calc_bg_scores[1] = &BGModel::score_order<1>;
+	calc_bg_scores[2] = &BGModel::score_order<2>;
+	calc_bg_scores[3] = &BGModel::score_order<3>;
+	calc_bg_scores[4] = &BGModel::score_order<4>;
+	calc_bg_scores[5] = &BGModel::score_order<5>;
+	calc_bg_scores[6] = &BGModel::score_order<6>;
+	calc_bg_scores[7] = &BGModel::score_order<7>;
+	calc_bg_scores[8] = &BGModel::score_order<8>;
+	calc_bg_scores[9] = &BGModel::score_order<9>;
+	calc_bg_scores[10] = &BGModel::score_order<10>;
+}
+
+void BGModel::init_models() {
+	for(int k = 0; k <= DENSE_ORDER; k++)
+		model[k].assign(k <= order ? 4 << (2 * k) : 0, 0);
+	for(int k = 0; k < MAX_ORDER - DENSE_ORDER; k++) {
+		sparse[k].clear();
+		sparse_counts[k].clear();
+	}
+}
+
+void BGModel::calc_gc() {
 	int ss_num_seqs = seqset.num_seqs();
 	
 	int len;
+	long gc_total = 0;
 	for(int i = 0; i < ss_num_seqs; i++) {
-		gc[i] = 0.0;
+		long n = 0;
 		len = seqset.len_seq(i);
-		for(int j = 0; j < len; j++) {
-			if(seq[i][j] == 1 || seq[i][j] == 2) {
-				gc[i]++;
-			}
-		}
-		gc_genome += gc[i];
+		// C (01) and G (10) are the codes whose two bits differ
+		for(int j = 0; j < len; j += 32) {
+			uint64_t w = seqset.word(i, j);
+			uint64_t is_gc = (w ^ (w >> 1)) & 0x5555555555555555ULL;
+			if(len - j < 32)
+				is_gc &= (1ULL << ((len - j) << 1)) - 1;
+			n += __builtin_popcountll(is_gc);
+		}
+		gc[i] = n;
 		gc[i] /= len;
+		gc_total += n;
 		total_seq_len += len;
 	}
-	gc_genome /= total_seq_len;
-	
-	train_background[0] = &BGModel::train_background_0;
-	train_background[1] = &BGModel::train_background_1;
-	train_background[2] = &BGModel::train_background_2;
-	train_background[3] = &BGModel::train_background_3;
-	train_background[4] = &BGModel::train_background_4;
-	train_background[5] = &BGModel::train_background_5;
-	
-	calc_bg_scores[0] = &BGModel::calc_bg_scores_0;
-	calc_bg_scores[1] = &BGModel::calc_bg_scores_1;
-	calc_bg_scores[2] = &BGModel::calc_bg_scores_2;
-	calc_bg_scores[3] = &BGModel::calc_bg_scores_3;
-	calc_bg_scores[4] = &BGModel::calc_bg_scores_4;
-	calc_bg_scores[5] = &BGModel::calc_bg_scores_5;
-	
-	for(int i = 0; i <= order; i++) {
-		(*this.*train_background[i])();
+	// Ambiguous bases are stored as A, so leave them out of the overall
+	// content, as count_kmers() does
+	long nambig = 0;
+	for(long r = 0; r < seqset.num_ambiguous_runs(); r++)
+		nambig += seqset.ambiguous_runs()[r].second - seqset.ambiguous_runs()[r].first;
+	gc_genome = (double) gc_total / max(total_seq_len - nambig, 1L);
+}
+
+void BGModel::calc_scores() {
+	if(folded()) return;
+	if(lean) {
+		for(int k = 0; k <= min(order, DENSE_ORDER); k++) {
+			logmodel[k].resize(model[k].size());
+			for(unsigned int i = 0; i < model[k].size(); i++)
+				logmodel[k][i] = log(model[k][i]);
+		}
+		block_seq.resize((seqset.total_len() >> 10) + 1);
+		int i = 0;
+		for(unsigned long b = 0; b < block_seq.size(); b++) {
+			while(i < seqset.num_seqs() - 1 && seqset.offset(i + 1) <= (long) (b << 10)) i++;
+			block_seq[b] = i;
+		}
+		return;
 	}
-	
 	(*this.*calc_bg_scores[order])();
 	
-	float last_cumul_score = 0.0;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seqset.len_seq(i);
-		cumulscores[i].push_back(last_cumul_score - wbgscores[i][0] - cbgscores[i][0]);
-		for(int j = 1; j < len; j++)
-			cumulscores[i].push_back(cumulscores[i][j-1] - wbgscores[i][j] - cbgscores[i][j]);
-		assert(cumulscores[i].size() == (unsigned int) len);
-		last_cumul_score = cumulscores[i][len - 1];
+	// Sums run over the whole buffer rather than restarting in each sequence:
+	// a window at the end of a sequence reads the sum at the next one's start,
+	// so that entry has to serve both. Across a genome they reach about 1e10,
+	// where a double is good to about 1e-6, so they are accumulated in long
+	// double and each rounded once; a window's score, the difference of two
+	// of them, is then off by at most about 1e-6, next to the 1e-7 per base
+	// that storing the scores as float already costs
+	long total_len = seqset.total_len();
+	wcumul_store.resize(total_len + 1);
+	ccumul_store.resize(total_len + 1);
+	long double w = 0, c = 0;
+	wcumul_store[0] = ccumul_store[0] = 0;
+	for(long j = 0; j < total_len; j++) {
+		w += wbg_store[j];
+		c += cbg_store[j];
+		wcumul_store[j + 1] = w;
+		ccumul_store[j + 1] = c;
 	}
+	wbgscores = &wbg_store[0];
+	cbgscores = &cbg_store[0];
+	wcumul = &wcumul_store[0];
+	ccumul = &ccumul_store[0];
 }
 
-double BGModel::score_site(vector<int>::const_iterator first_col, vector<int>::const_iterator last_col, const int width,
-													 const int c, const int p, const bool s) const {
-	double L = 0.0;
-	int matpos;
-	vector<int>::const_iterator col_iter = first_col;
-	if(s) {
-		matpos = 0;
-		for(; col_iter != last_col; ++col_iter) {
-			assert(p + *col_iter >= 0);
-			assert(p + *col_iter < seqset.len_seq(c));
-			L += wbgscores[c][p + *col_iter];
-			matpos += 4;
-		}
-	} else {
-		matpos = 0;
-		for(; col_iter != last_col; ++col_iter) {
-			assert(p + width - 1 - *col_iter >= 0);
-			assert(p + width - 1 - *col_iter < seqset.len_seq(c));
-			L += cbgscores[c][p + width - 1 - *col_iter];
-			matpos += 4;
-		}
-	}
-	return L;
+// An order 0 background scores each base on its own, the same on either
+// strand once the Crick base is complemented, as score matrices index it.
+// Subtracting it from every column gives a log-odds matrix, with the scores
+// rounded to float as score_order<0>() would store them.
+void BGModel::fold(double* sm, const int ncols) const {
+	if(! folded()) return;
+	double bg[4];
+	for(int j = 0; j < 4; j++)
+		bg[j] = (float) log(model[0][j]);
+	for(int i = 0; i < 4 * ncols; i += 4)
+		for(int j = 0; j < 4; j++)
+			sm[i + j] -= bg[j];
 }
 
-void BGModel::train_background_5() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	for(int i = 0; i < 4096; i++) {
-		model5[i] = 0;
-	}
-	
-	// Add pseudocounts
-	float atpseudo = 10 * (1 - gc_genome)/2;
-	float gcpseudo = 10 * gc_genome/2;
-	for(int i = 0; i < 4096; i++) {
-		switch(i % 4) {
-			case 1:
-			case 4:
-				model5[i] += atpseudo;
-				break;
-			case 2:
-			case 3:
-				model5[i] += gcpseudo;
-				break;
-		}
-	}
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		// Compute counts for forward strand
-		for(int j = 5; j < len; j++) {
-			model5[seq[i][j - 5] * 1024
-				+ seq[i][j - 4] * 256
-				+ seq[i][j - 3] * 64
-				+ seq[i][j - 2] * 16 
-				+ seq[i][j - 1] * 4
-				+ seq[i][j]]++;
-		}
-		// Compute counts for reverse strand
-		for(int j = len - 6; j >= 0; j--) {
-			model5[(3 - seq[i][j + 5]) * 1024
-				+ (3 - seq[i][j + 4]) * 256
-				+ (3 - seq[i][j + 3]) * 64
-				+ (3 - seq[i][j + 2]) * 16
-				+ (3 - seq[i][j + 1]) * 4
-				+ (3 - seq[i][j])]++;
-		}
+void BGModel::write_tables(ostream& out) const {
+	out.write((const char*) &order, sizeof(order));
+	out.write((const char*) &gc_genome, sizeof(gc_genome));
+	for(int i = 0; i <= min(order, DENSE_ORDER); i++)
+		out.write((const char*) &model[i][0], model[i].size() * sizeof(float));
+	for(int i = DENSE_ORDER + 1; i <= order; i++)
+		sparse[i - DENSE_ORDER - 1].write(out);
+}
 
+void BGModel::read_tables(istream& in) {
+	in.read((char*) &order, sizeof(order));
+	in.read((char*) &gc_genome, sizeof(gc_genome));
+	if(! in || order < 0 || order > MAX_ORDER) {
+		cerr << "Invalid background model tables!\n";
+		exit(1);
 	}
-	
-	// Normalize
-	float total;
-	for(int i = 0; i < 1024; i++) {
-		total = model5[4 * i] + model5[4 * i + 1] + model5[4 * i + 2] + model5[4 * i + 3];
-		model5[4 * i] /= total;
-		model5[4 * i + 1] /= total;
-		model5[4 * i + 2] /= total;
-		model5[4 * i + 3] /= total;
+	init_models();
+	for(int i = 0; i <= min(order, DENSE_ORDER); i++)
+		in.read((char*) &model[i][0], model[i].size() * sizeof(float));
+	for(int i = DENSE_ORDER + 1; i <= order; i++)
+		if(! sparse[i - DENSE_ORDER - 1].read(in)) break;
+	if(! in) {
+		cerr << "Truncated background model tables!\n";
+		exit(1);
 	}
 }
 
-void BGModel::train_background_4() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	for(int i = 0; i < 1024; i++) {
-		model4[i] = 0;
+// Background files are the tables from write_tables() after a magic string
+bool BGModel::write_file(const char* filename) const {
+	ofstream out(filename, ios::binary);
+	if(! out) return false;
+	out.write("MSPBGMOD", 8);
+	write_tables(out);
+	out.close();
+	return ! out.fail();
+}
+
+bool BGModel::read_file(const char* filename, string& tables) {
+	ifstream in(filename, ios::binary);
+	if(! in) return false;
+	char magic[8];
+	in.read(magic, 8);
+	if(! in || memcmp(magic, "MSPBGMOD", 8) != 0) return false;
+	ostringstream rest;
+	rest << in.rdbuf();
+	tables = rest.str();
+	return tables.length() >= sizeof(int) + sizeof(float);
+}
+
+int BGModel::tables_order(const string& tables) {
+	int ord;
+	memcpy(&ord, tables.data(), sizeof(ord));
+	return ord;
+}
+
+// Reads the bases of a Seqset forward from a global position, a word at a time
+struct BaseReader {
+	const Seqset& seqset;
+	long next_word;
+	uint64_t bits;
+	int avail;
+	BaseReader(const Seqset& s, const long gp) : seqset(s), next_word(gp), bits(0), avail(0) {}
+	unsigned long next() {
+		if(avail == 0) {
+			bits = seqset.word_at(next_word);
+			next_word += 32;
+			avail = 32;
+		}
+		unsigned long b = bits & 3;
+		bits >>= 2;
+		avail--;
+		return b;
 	}
-	
-	// Add pseudocounts
-	float atpseudo = 10 * (1 - gc_genome)/2;
-	float gcpseudo = 10 * gc_genome/2;
-	for(int i = 0; i < 1024; i++) {
-		switch(i % 4) {
-			case 1:
-			case 4:
-				model4[i] += atpseudo;
-				break;
-			case 2:
-			case 3:
-				model4[i] += gcpseudo;
-				break;
+};
+
+// Score a window as score_order() would have, rolling the k-mer indexes
+// over the window and the order bases on either side that give it context.
+// Only bases in the window's own sequence count as context, so bases within
+// order of either end of it use lower orders; elsewhere a dense model is
+// read directly.
+double BGModel::lean_score(const vector<pair<int, int> >& runs, const int width, const long gp, const bool s) const {
+	const long* offs = seqset.offset_table();
+	int i = block_seq[gp >> 10];
+	while(offs[i + 1] <= gp) i++;
+	const long start = offs[i];
+	const long end = start + seqset.len_seq(i);
+	const unsigned long mask = (1UL << (2 * (order + 1))) - 1;
+	const float* lm = order <= DENSE_ORDER ? &logmodel[order][0] : NULL;
+	double L = 0.0;
+	if(lm != NULL && width + order <= 32 && gp - order >= start && gp + width + order <= end) {
+		// Away from the ends of the sequence every base has a full context, and a
+		// window and its context fit in one word, so it is scored without branches
+		uint64_t cols = 0;
+		for(vector<pair<int, int> >::const_iterator ri = runs.begin(); ri != runs.end(); ++ri)
+			cols |= ((1ULL << ri->second) - 1) & ~((1ULL << ri->first) - 1);
+		if(s) {
+			uint64_t bases = seqset.word_at(gp - order);
+			unsigned long w = 0;
+			for(int k = 0; k < order; k++, bases >>= 2)
+				w = (w << 2) | (bases & 3);
+			for(int k = 0; k < width; k++, bases >>= 2) {
+				w = ((w << 2) | (bases & 3)) & mask;
+				L += ((cols >> k) & 1) ? lm[w] : 0.0;
+			}
+		} else {
+			// The Crick index of gp + k is complete once gp + k + order has been read
+			uint64_t bases = seqset.word_at(gp);
+			unsigned long c = 0;
+			for(int k = 0; k < order; k++, bases >>= 2)
+				c = (c >> 2) | ((3 - (bases & 3)) << (2 * order));
+			for(int k = 0; k < width; k++, bases >>= 2) {
+				c = (c >> 2) | ((3 - (bases & 3)) << (2 * order));
+				L += ((cols >> (width - 1 - k)) & 1) ? lm[c] : 0.0;
+			}
 		}
+		return L;
 	}
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		// Compute counts for forward strand
-		for(int j = 4; j < len; j++) {
-			model4[seq[i][j - 4] * 256
-				+ seq[i][j - 3] * 64
-				+ seq[i][j - 2] * 16 
-				+ seq[i][j - 1] * 4
-				+ seq[i][j]]++;
+	if(s) {
+		long q = max(start, gp - order);
+		BaseReader bases(seqset, q);
+		const long full = start + order;                             // first base with a full context
+		unsigned long w = 0;
+		for(vector<pair<int, int> >::const_iterator ri = runs.begin(); ri != runs.end(); ++ri) {
+			for(; q < gp + ri->first; q++)
+				w = ((w << 2) | bases.next()) & mask;
+			for(; q < gp + ri->second; q++) {
+				w = ((w << 2) | bases.next()) & mask;
+				L += (lm != NULL && q >= full) ? lm[w] : log_prob(min((long) order, q - start), w);
+			}
 		}
-		// Compute counts for reverse strand
-		for(int j = len - 5; j >= 0; j--) {
-			model4[(3 - seq[i][j + 4]) * 256
-				+ (3 - seq[i][j + 3]) * 64
-				+ (3 - seq[i][j + 2]) * 16
-				+ (3 - seq[i][j + 1]) * 4
-				+ (3 - seq[i][j])]++;
+	} else {
+		// Column c is at p = gp + width - 1 - c, and the Crick index of p is
+		// complete once the base order after it has been read
+		const long top = gp + width - 1;
+		long q = gp;
+		BaseReader bases(seqset, q);
+		unsigned long c = 0;
+		for(vector<pair<int, int> >::const_reverse_iterator ri = runs.rbegin(); ri != runs.rend(); ++ri) {
+			for(long p = top - ri->second + 1; p <= top - ri->first; p++) {
+				const long last = min(p + order, end - 1);
+				for(; q <= last; q++)
+					c = (c >> 2) | ((3 - bases.next()) << (2 * order));
+				if(last == p + order)
+					L += (lm != NULL) ? lm[c] : log_prob(order, c);
+				else
+					L += log_prob(end - 1 - p, c >> (2 * (p + order - last)));
+			}
 		}
+	}
+	return L;
+}
 
+void BGModel::column_runs(vector<int>::const_iterator first_col, vector<int>::const_iterator last_col,
+		vector<pair<int, int> >& runs) {
+	runs.clear();
+	for(vector<int>::const_iterator ci = first_col; ci != last_col; ++ci) {
+		if(! runs.empty() && runs.back().second == *ci)
+			runs.back().second++;
+		else
+			runs.push_back(make_pair(*ci, *ci + 1));
 	}
-	
-	// Normalize
-	float total;
-	for(int i = 0; i < 256; i++) {
-		total = model4[4 * i] + model4[4 * i + 1] + model4[4 * i + 2] + model4[4 * i + 3];
-		model4[4 * i] /= total;
-		model4[4 * i + 1] /= total;
-		model4[4 * i + 2] /= total;
-		model4[4 * i + 3] /= total;
+}
+
+struct BGModel::KmerCounts {
+	vector<unsigned int> dense[DENSE_ORDER + 1];                   // by (k+1)-mer
+	KmerTable<unsigned int> sparse[MAX_ORDER - DENSE_ORDER];       // by k-mer context, for orders above DENSE_ORDER
+	long gc;                                                       // number of G and C bases counted
+	long bases;                                                    // number of bases counted
+};
+
+struct BGModel::CountJob {
+	const BGModel* model;
+	const Seqset* seqs;
+	long from;                                                     // global position of the first base read
+	long to;                                                       // global position after the last
+	int skip;                                                      // bases read from there on that another job counts
+	KmerCounts counts;
+};
+
+// Cuts a FASTA file into Seqsets of about CHUNK_BASES bases and counts
+// them a batch at a time, one chunk per job. A record cut between chunks
+// carries its last bases over into the next chunk, where they are skipped,
+// so that every k-mer is counted exactly once.
+class BGModel::ChunkSink : public FastaSink {
+	BGModel& model;
+	vector<CountJob>& jobs;
+	vector<Seqset*> chunks;                                        // the last one is being filled
+	vector<int> skips;
+	long record_start;                                             // where the open record starts in the last chunk
+
+	void new_chunk(const int skip);
+	void count(const int n);                                       // Count and free the first n chunks
+
+public:
+	ChunkSink(BGModel& m, vector<CountJob>& j) : model(m), jobs(j), record_start(0) { new_chunk(0); };
+	~ChunkSink();
+	void begin_record(const string& name);
+	void bases(const char* s, const long n);
+	void end_record();
+	void finish() { count(chunks.size()); };                      // Count what is left, after the parser's finish()
+};
+
+BGModel::ChunkSink::~ChunkSink() {
+	for(unsigned int i = 0; i < chunks.size(); i++)
+		delete chunks[i];
+}
+
+void BGModel::ChunkSink::new_chunk(const int skip) {
+	if(chunks.size() == jobs.size()) count(jobs.size());
+	Seqset* c = new Seqset();
+	c->reserve(CHUNK_BASES);
+	chunks.push_back(c);
+	skips.push_back(skip);
+	record_start = 0;
+}
+
+void BGModel::ChunkSink::count(const int n) {
+	for(int t = 0; t < n; t++) {
+		jobs[t].seqs = chunks[t];
+		jobs[t].from = 0;
+		jobs[t].to = chunks[t]->total_len();
+		jobs[t].skip = skips[t];
 	}
+	run_jobs(&jobs[0], n);
+	model.merge_sparse(jobs);
+	for(int t = 0; t < n; t++)
+		delete chunks[t];
+	chunks.erase(chunks.begin(), chunks.begin() + n);
+	skips.erase(skips.begin(), skips.begin() + n);
 }
 
-void BGModel::train_background_3() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	for(int i = 0; i < 256; i++) {
-		model3[i] = 0;
+void BGModel::ChunkSink::begin_record(const string&) {
+	if(chunks.back()->total_len() >= CHUNK_BASES) new_chunk(0);
+	record_start = chunks.back()->total_len();
+}
+
+void BGModel::ChunkSink::bases(const char* s, const long n) {
+	const int carry = model.order;
+	for(long i = 0; i < n;) {
+		Seqset* c = chunks.back();
+		long room = CHUNK_BASES - c->total_len();
+		long open = c->total_len() - record_start;
+		if(room <= 0 && open >= carry) {
+			// Cut the record, carrying its last bases into the next chunk
+			char tail[MAX_ORDER];
+			c->end_seq();
+			c->unpack(c->num_seqs() - 1, open - carry, carry, tail);
+			for(int k = 0; k < carry; k++)
+				tail[k] = c->is_ambiguous(c->num_seqs() - 1, open - carry + k) ? 'N' : "ACGT"[(int) tail[k]];
+			new_chunk(carry);
+			chunks.back()->append(tail, carry);
+			continue;
+		}
+		long m = room > 0 ? min(n - i, room) : min(n - i, (long) carry - open);
+		c->append(s + i, m);
+		i += m;
 	}
-	
-	// Add pseudocounts
-	float atpseudo = 10 * (1 - gc_genome)/2;
-	float gcpseudo = 10 * gc_genome/2;
-	for(int i = 0; i < 256; i++) {
-		switch(i % 4) {
-			case 1:
-			case 4:
-				model3[i] += atpseudo;
-				break;
-			case 2:
-			case 3:
-				model3[i] += gcpseudo;
-				break;
+}
+
+void BGModel::ChunkSink::end_record() {
+	chunks.back()->end_seq();
+}
+
+void* BGModel::count_thread(void* arg) {
+	CountJob* job = (CountJob*) arg;
+	const BGModel* m = job->model;
+	(m->*(m->count_background[m->order]))(*job->seqs, job->from, job->to, job->skip, job->counts);
+	return NULL;
+}
+
+void BGModel::init_counts(KmerCounts& counts) const {
+	for(int k = 1; k <= min(order, DENSE_ORDER); k++)
+		counts.dense[k].assign(4 << (2 * k), 0);
+	counts.gc = 0;
+	counts.bases = 0;
+}
+
+void BGModel::run_jobs(CountJob* jobs, const int n) {
+	vector<pthread_t> threads(n);
+	for(int t = 1; t < n; t++)
+		if(pthread_create(&threads[t], NULL, count_thread, &jobs[t]) != 0) {
+			cerr << "Unable to start background training thread\n";
+			exit(1);
+		}
+	if(n > 0) count_thread(&jobs[0]);
+	for(int t = 1; t < n; t++) pthread_join(threads[t], NULL);
+}
+
+void BGModel::merge_dense(vector<CountJob>& jobs) {
+	for(int k = 1; k <= min(order, DENSE_ORDER); k++) {
+		vector<float>& m = model[k];
+		for(unsigned int i = 0; i < m.size(); i++) {
+			unsigned long n = 0;
+			for(unsigned int t = 0; t < jobs.size(); t++) n += jobs[t].counts.dense[k][i];
+			m[i] = n;
 		}
 	}
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		// Compute counts for forward strand
-		for(int j = 3; j < len; j++) {
-			model3[seq[i][j - 3] * 64
-								+ seq[i][j - 2] * 16 
-								+ seq[i][j - 1] * 4
-								+ seq[i][j]]++;
-		}
-		// Compute counts for reverse strand
-		for(int j = len - 4; j >= 0; j--) {
-			model3[(3 - seq[i][j + 3]) * 64
-								+ (3 - seq[i][j + 2]) * 16
-								+ (3 - seq[i][j + 1]) * 4
-								+ (3 - seq[i][j])]++;
-		}
+}
 
-	}
-	
-	// Normalize
-	float total;
-	for(int i = 0; i < 64; i++) {
-		total = model3[4 * i] + model3[4 * i + 1] + model3[4 * i + 2] + model3[4 * i + 3];
-		model3[4 * i] /= total;
-		model3[4 * i + 1] /= total;
-		model3[4 * i + 2] /= total;
-		model3[4 * i + 3] /= total;
+void BGModel::merge_sparse(vector<CountJob>& jobs) {
+	for(int k = DENSE_ORDER + 1; k <= order; k++) {
+		KmerTable<unsigned long>& dest = sparse_counts[k - DENSE_ORDER - 1];
+		for(unsigned int t = 0; t < jobs.size(); t++) {
+			KmerTable<unsigned int>& src = jobs[t].counts.sparse[k - DENSE_ORDER - 1];
+			if(src.size() == 0) continue;
+			for(long s = 0; s < src.capacity(); s++) {
+				if(! src.occupied(s)) continue;
+				const unsigned int* n = src.slot_values(s);
+				unsigned long* p = dest.insert(src.context(s));
+				for(int b = 0; b < 4; b++) p[b] += n[b];
+			}
+			src.clear();
+		}
 	}
 }
 
-void BGModel::train_background_2() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	for(int i = 0; i < 64; i++) {
-		model2[i] = 0;
+// Count every order in one pass over the sequences, split into ranges of
+// equal length with one range per thread. A range starting inside a
+// sequence reads the K bases before it again, to get the (k+1)-mers that
+// end in it, but leaves their counts to the range before. Counts are summed
+// as integers and merged into the model tables, which train_order() and
+// train_interpolated() then turn into probabilities.
+void BGModel::count_all(const int nthreads) {
+	if(order == 0) return;
+	const long* offs = seqset.offset_table();
+	vector<CountJob> jobs(nthreads);
+	long stop = 0;
+	for(int t = 0; t < nthreads; t++) {
+		int c = upper_bound(offs, offs + seqset.num_seqs(), stop) - offs - 1;
+		jobs[t].model = this;
+		jobs[t].seqs = &seqset;
+		jobs[t].from = c < 0 ? stop : max(stop - order, offs[c]);
+		jobs[t].skip = stop - jobs[t].from;
+		stop = (t == nthreads - 1) ? seqset.total_len() : (t + 1) * (seqset.total_len() / nthreads);
+		jobs[t].to = stop;
+		init_counts(jobs[t].counts);
 	}
-	
-	// Add pseudocounts
-	float atpseudo = 10 * (1 - gc_genome)/2;
-	float gcpseudo = 10 * gc_genome/2;
-	for(int i = 0; i < 64; i++) {
-		switch(i % 4) {
-			case 1:
-			case 4:
-				model2[i] += atpseudo;
-				break;
-			case 2:
-			case 3:
-				model2[i] += gcpseudo;
-				break;
+	run_jobs(&jobs[0], nthreads);
+	merge_dense(jobs);
+	merge_sparse(jobs);
+}
+
+// Count the (k+1)-mers in bases from to to - 1 on both strands for every
+// order k from 1 to K, leaving out those ending in the first skip bases.
+// w holds the last K+1 bases read, most recent in the low bits, so its low
+// k+1 bases are the Watson index; c holds their complements with the most
+// recent in the high bits, so its high k+1 bases are the index of the Crick
+// (k+1)-mer ending k bases back. Ambiguous bases are stored as A, so no
+// (k+1)-mer touching one is counted, nor the base itself: clean is the
+// number of bases read since the last of them. This holds with or without
+// -mask, so runs of N no longer train the model as runs of A; without -mask
+// the scanner still scores windows over them, as poly-A.
+template<int K> void BGModel::count_kmers(const Seqset& s, const long from, const long to, const int skip,
+		KmerCounts& counts) const {
+	const int D = K < DENSE_ORDER ? K : DENSE_ORDER;
+	const unsigned long mask = (1UL << (2 * (K + 1))) - 1;
+	unsigned int* dense[DENSE_ORDER + 1];
+	for(int o = 1; o <= D; o++) dense[o] = &counts.dense[o][0];
+	const long* offs = s.offset_table();
+	const pair<long, long>* run_end = s.ambiguous_runs() + s.num_ambiguous_runs();
+	int i = max(0, (int) (upper_bound(offs, offs + s.num_seqs(), from) - offs) - 1);
+	for(; i < s.num_seqs() && s.offset(i) < to; i++) {
+		long start = s.offset(i);
+		int first = max(from, start) - start;                      // first base read
+		int len = min(to, start + s.len_seq(i)) - start;           // and the one after the last
+		int counted = max(from + skip - start, (long) first);      // first base counted
+		const pair<long, long>* ai = upper_bound(s.ambiguous_runs(), run_end, make_pair(start + first, LONG_MAX));
+		if(ai != s.ambiguous_runs() && (ai - 1)->second > start + first) --ai;
+		long next = ai < run_end ? ai->first - start : LONG_MAX;    // next ambiguous base, in the sequence
+		unsigned long w = 0, c = 0;
+		int clean = 0;
+		for(int j = first; j < len; j += 32) {
+			uint64_t bases = s.word(i, j);
+			int n = min(32, len - j);
+			for(int k = 0; k < n; k++, bases >>= 2) {
+				if(j + k >= next) {
+					// Start again after the run, with no context across it
+					w = c = 0;
+					clean = 0;
+					if(start + j + k + 1 >= ai->second) {
+						++ai;
+						next = ai < run_end ? ai->first - start : LONG_MAX;
+					}
+					continue;
+				}
+				unsigned long b = bases & 3;
+				w = ((w << 2) | b) & mask;
+				c = (c >> 2) | ((3 - b) << (2 * K));
+				if(j + k < counted) {
+					clean++;
+					continue;
+				}
+				counts.gc += (b ^ (b >> 1)) & 1;
+				counts.bases++;
+				for(int o = 1; o <= D && o <= clean; o++) {
+					dense[o][w & ((1UL << (2 * (o + 1))) - 1)]++;
+					dense[o][c >> (2 * (K - o))]++;
+				}
+				for(int o = DENSE_ORDER + 1; o <= K && o <= clean; o++) {
+					KmerTable<unsigned int>& t = counts.sparse[o - DENSE_ORDER - 1];
+					unsigned long wo = w & ((1UL << (2 * (o + 1))) - 1);
+					unsigned long co = c >> (2 * (K - o));
+					t.insert(wo >> 2)[wo & 3]++;
+					t.insert(co >> 2)[co & 3]++;
+				}
+				clean++;
+			}
 		}
 	}
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		// Compute counts for forward strand
-		for(int j = 2; j < len; j++) {
-			model2[seq[i][j - 2] * 16 
-								+ seq[i][j - 1] * 4
-								+ seq[i][j]]++;
-		}
-		// Compute counts for reverse strand
-		for(int j = len - 3; j >= 0; j--) {
-			model2[(3 - seq[i][j + 2]) * 16
-								+ (3 - seq[i][j + 1]) * 4
-								+ (3 - seq[i][j])]++;
-		}
+}
 
+// Training on a file counts it in chunks, so the whole file never has to
+// be in memory, and gives the same tables as training on it as one Seqset.
+BGModel::BGModel(const Seqset& none, const char* filename, const int ord, const int nthreads) :
+seqset(none),
+total_seq_len(0),
+order(ord),
+gc_genome(0),
+gc(0),
+wbgscores(NULL),
+cbgscores(NULL),
+wcumul(NULL),
+ccumul(NULL),
+wbg_store(0),
+cbg_store(0),
+wcumul_store(0),
+ccumul_store(0),
+lean(false) {
+	if(order < 0 || order > MAX_ORDER) {
+		cerr << "Background model order must be between 0 and " << MAX_ORDER << "\n";
+		exit(1);
 	}
-	
-	// Normalize
-	float total;
-	for(int i = 0; i < 16; i++) {
-		total = model2[4 * i] + model2[4 * i + 1] + model2[4 * i + 2] + model2[4 * i + 3];
-		model2[4 * i] /= total;
-		model2[4 * i + 1] /= total;
-		model2[4 * i + 2] /= total;
-		model2[4 * i + 3] /= total;
+	set_functions();
+	init_models();
+	vector<CountJob> jobs(max(nthreads, 1));
+	for(unsigned int t = 0; t < jobs.size(); t++) {
+		jobs[t].model = this;
+		init_counts(jobs[t].counts);
+	}
+	ChunkSink sink(*this, jobs);
+	read_fasta(filename, sink, nthreads);
+	sink.finish();
+	merge_dense(jobs);
+	long gc_total = 0;
+	for(unsigned int t = 0; t < jobs.size(); t++) {
+		gc_total += jobs[t].counts.gc;
+		total_seq_len += jobs[t].counts.bases;
+	}
+	if(total_seq_len == 0) {
+		cerr << "No sequences in '" << filename << "'\n";
+		exit(1);
+	}
+	gc_genome = (double) gc_total / total_seq_len;
+	for(int i = 0; i <= order; i++) {
+		(*this.*train_background[i])();
 	}
 }
 
-void BGModel::train_background_1() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	for(int i = 0; i < 16; i++) {
-		model1[i] = 0;
-	}
+string BGModel::train_file(const char* filename, const int ord, const int nthreads) {
+	Seqset none;
+	BGModel bgm(none, filename, ord, nthreads);
+	ostringstream tables;
+	bgm.write_tables(tables);
+	return tables.str();
+}
+
+template<int K> void BGModel::train_order() {
+	vector<float>& m = model[K];
 	
-	// Add pseudocounts
+	// Add pseudocounts to the counts from count_all()
 	float atpseudo = 10 * (1 - gc_genome)/2;
 	float gcpseudo = 10 * gc_genome/2;
-	for(int i = 0; i < 16; i++) {
+	for(unsigned int i = 0; i < m.size(); i++) {
 		switch(i % 4) {
 			case 1:
 			case 4:
-				model1[i] += atpseudo;
+				m[i] += atpseudo;
 				break;
 			case 2:
 			case 3:
-				model1[i] += gcpseudo;
+				m[i] += gcpseudo;
 				break;
 		}
 	}
 	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		// Compute counts for forward strand
-		for(int j = 1; j < len; j++) {
-			model1[seq[i][j - 1] * 4
-								+ seq[i][j]]++;
-		}
-		// Compute counts for reverse strand
-		for(int j = len - 2; j >= 0; j--) {
-			model1[(3 - seq[i][j + 1]) * 4
-								+ (3 - seq[i][j])]++;
-		}
-
-	}
-	
 	// Normalize
 	float total;
-	for(int i = 0; i < 4; i++) {
-		total = model1[4 * i] + model1[4 * i + 1] + model1[4 * i + 2] + model1[4 * i + 3];
-		model1[4 * i] /= total;
-		model1[4 * i + 1] /= total;
-		model1[4 * i + 2] /= total;
-		model1[4 * i + 3] /= total;
-	}
-}
-
-void BGModel::train_background_0() {
-	for(int i = 0; i < 4; i++) {
-		model0[i] = 0;
-	}
-	
-	// Just use genome-wide GC content
-	model0[0] = (1 - gc_genome)/2;
-	model0[1] = gc_genome/2;
-	model0[2] = model0[1];
-	model0[3] = model0[0];
-}
-
-void BGModel::calc_bg_scores_5() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		wbgscores[i].clear();
-		cbgscores[i].clear();
-		wbgscores[i].reserve(len);
-		cbgscores[i].reserve(len);
-		
-		// Use lower order models for first five Watson bases
-		wbgscores[i].push_back(log(model0[seq[i][0]]));
-		wbgscores[i].push_back(log(model1[seq[i][0] * 4 
-															+ seq[i][1]]));
-		wbgscores[i].push_back(log(model2[seq[i][0] * 16 
-															+ seq[i][1] * 4 
-															+ seq[i][2]]));
-		if(len > 3) {
-			wbgscores[i].push_back(log(model3[seq[i][0] * 64 
-																+ seq[i][1] * 16 
-																+ seq[i][2] * 4
-																+ seq[i][3]]));
-		}
-		if(len > 4) {
-			wbgscores[i].push_back(log(model4[seq[i][0] * 256
-																+ seq[i][1] * 64 
-																+ seq[i][2] * 16 
-																+ seq[i][3] * 4
-																+ seq[i][4]]));
-		}
-		
-		// Use fifth-order model for most bases
-		for(int j = 5; j < len; j++) {
-			wbgscores[i].push_back(log(model5[seq[i][j - 5] * 1024
-																+ seq[i][j - 4] * 256
-			                          + seq[i][j - 3] * 64
-																+ seq[i][j - 2] * 16 
-																+ seq[i][j - 1] * 4
-																+ seq[i][j]]));
-		}
-		for(int j = 0; j < len - 5; j++) {
-			cbgscores[i].push_back(log(model5[(3 - seq[i][j + 5]) * 1024
-																+ (3 - seq[i][j + 4]) * 256
-			                          + (3 - seq[i][j + 3]) * 64
-																+ (3 - seq[i][j + 2]) * 16
-																+ (3 - seq[i][j + 1]) * 4
-																+ (3 - seq[i][j])]));
-		}
-		
-		// Use lower order models for last four Crick bases
-		if(len > 4) {
-			cbgscores[i].push_back(log(model4[(3 - seq[i][len - 1]) * 256
-																+ (3 - seq[i][len - 2]) * 64
-																+ (3 - seq[i][len - 3]) * 16
-																+ (3 - seq[i][len - 4]) * 4
-																+ (3 - seq[i][len - 5])]));
-		}
-		if(len > 3) {
-		cbgscores[i].push_back(log(model3[(3 - seq[i][len - 1]) * 64
-															+ (3 - seq[i][len - 2]) * 16
-															+ (3 - seq[i][len - 3]) * 4
-															+ (3 - seq[i][len - 4])]));
-		}
-		cbgscores[i].push_back(log(model2[(3 - seq[i][len - 1]) * 16 
-															+ (3 - seq[i][len - 2]) * 4 
-															+ (3 - seq[i][len - 3])]));
-		cbgscores[i].push_back(log(model1[(3 - seq[i][len - 1]) * 4 
-															+ (3 - seq[i][len - 2])]));
-		cbgscores[i].push_back(log(model0[3 - seq[i][len - 1]]));
-	
-		assert(wbgscores[i].size() == (unsigned int) len);
-		assert(cbgscores[i].size() == (unsigned int) len);
+	for(unsigned int i = 0; i < m.size() / 4; i++) {
+		total = m[4 * i] + m[4 * i + 1] + m[4 * i + 2] + m[4 * i + 3];
+		m[4 * i] /= total;
+		m[4 * i + 1] /= total;
+		m[4 * i + 2] /= total;
+		m[4 * i + 3] /= total;
 	}
 }
 
-void BGModel::calc_bg_scores_4() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		wbgscores[i].clear();
-		cbgscores[i].clear();
-		wbgscores[i].reserve(len);
-		cbgscores[i].reserve(len);
-		
-		// Use lower order models for first four Watson bases
-		wbgscores[i].push_back(log(model0[seq[i][0]]));
-		wbgscores[i].push_back(log(model1[seq[i][0] * 4 
-															+ seq[i][1]]));
-		wbgscores[i].push_back(log(model2[seq[i][0] * 16 
-															+ seq[i][1] * 4 
-															+ seq[i][2]]));
-		if(len > 4) {
-			wbgscores[i].push_back(log(model3[seq[i][0] * 64 
-																+ seq[i][1] * 16 
-																+ seq[i][2] * 4
-																+ seq[i][3]]));
-		}
-				
-		// Use third-order model for most bases
-		for(int j = 4; j < len; j++) {
-			wbgscores[i].push_back(log(model4[seq[i][j - 4] * 256
-			                          + seq[i][j - 3] * 64
-																+ seq[i][j - 2] * 16 
-																+ seq[i][j - 1] * 4
-																+ seq[i][j]]));
+// Orders above 5 have too many contexts for fixed pseudocounts, so each
+// context's counts are smoothed towards the order K-1 model of its last K-1
+// bases, which has weight LAMBDA: P(b|ctx) = (n_b + LAMBDA P'(b|ctx')) / (n + LAMBDA).
+// Contexts that never occur are not stored above DENSE_ORDER, and prob()
+// falls back to the lower order for them, which is the same estimate.
+template<int K> void BGModel::train_interpolated() {
+	const unsigned long lower = (1UL << (2 * K)) - 1;
+	if(K <= DENSE_ORDER) {
+		vector<float>& m = model[K];
+		for(unsigned long ctx = 0; ctx < m.size() / 4; ctx++) {
+			float* p = &m[4 * ctx];
+			float n = p[0] + p[1] + p[2] + p[3];
+			for(int b = 0; b < 4; b++)
+				p[b] = (p[b] + LAMBDA * prob(K - 1, (4 * ctx + b) & lower)) / (n + LAMBDA);
 		}
-		for(int j = 0; j < len - 4; j++) {
-			cbgscores[i].push_back(log(model4[(3 - seq[i][j + 4]) * 256
-			                          + (3 - seq[i][j + 3]) * 64
-																+ (3 - seq[i][j + 2]) * 16
-																+ (3 - seq[i][j + 1]) * 4
-																+ (3 - seq[i][j])]));
-		}
-		
-		// Use lower order models for last four Crick bases
-		if(len > 4) {
-			cbgscores[i].push_back(log(model3[(3 - seq[i][len - 1]) * 64
-																+ (3 - seq[i][len - 2]) * 16
-																+ (3 - seq[i][len - 3]) * 4
-																+ (3 - seq[i][len - 4])]));
-		}
-		cbgscores[i].push_back(log(model2[(3 - seq[i][len - 1]) * 16 
-															+ (3 - seq[i][len - 2]) * 4 
-															+ (3 - seq[i][len - 3])]));
-		cbgscores[i].push_back(log(model1[(3 - seq[i][len - 1]) * 4 
-															+ (3 - seq[i][len - 2])]));
-		cbgscores[i].push_back(log(model0[3 - seq[i][len - 1]]));
-	
-		assert(wbgscores[i].size() == (unsigned int) len);
-		assert(cbgscores[i].size() == (unsigned int) len);
-	}
-}
-
-void BGModel::calc_bg_scores_3() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		wbgscores[i].clear();
-		cbgscores[i].clear();
-		wbgscores[i].reserve(len);
-		cbgscores[i].reserve(len);
-		
-		// Use lower order models for first three Watson bases
-		wbgscores[i].push_back(log(model0[seq[i][0]]));
-		wbgscores[i].push_back(log(model1[seq[i][0] * 4 
-															+ seq[i][1]]));
-		wbgscores[i].push_back(log(model2[seq[i][0] * 16 
-															+ seq[i][1] * 4 
-															+ seq[i][2]]));
-				
-		// Use third-order model for most bases
-		for(int j = 3; j < len; j++) {
-			wbgscores[i].push_back(log(model3[seq[i][j - 3] * 64
-																+ seq[i][j - 2] * 16 
-																+ seq[i][j - 1] * 4
-																+ seq[i][j]]));
-		}
-		for(int j = 0; j < len - 3; j++) {
-			cbgscores[i].push_back(log(model3[(3 - seq[i][j + 3]) * 64
-																+ (3 - seq[i][j + 2]) * 16
-																+ (3 - seq[i][j + 1]) * 4
-																+ (3 - seq[i][j])]));
-		}
-		
-		// Use lower order models for last three Crick bases
-		cbgscores[i].push_back(log(model2[(3 - seq[i][len - 1]) * 16 
-															+ (3 - seq[i][len - 2]) * 4 
-															+ (3 - seq[i][len - 3])]));
-		cbgscores[i].push_back(log(model1[(3 - seq[i][len - 1]) * 4 
-															+ (3 - seq[i][len - 2])]));
-		cbgscores[i].push_back(log(model0[3 - seq[i][len - 1]]));
-	
-		assert(wbgscores[i].size() == (unsigned int) len);
-		assert(cbgscores[i].size() == (unsigned int) len);
+	} else {
+		KmerTable<unsigned long>& counts = sparse_counts[K - DENSE_ORDER - 1];
+		KmerTable<float>& t = sparse[K - DENSE_ORDER - 1];
+		for(long s = 0; s < counts.capacity(); s++) {
+			if(! counts.occupied(s)) continue;
+			const unsigned long* c = counts.slot_values(s);
+			float* p = t.insert(counts.context(s));
+			float n = c[0] + c[1] + c[2] + c[3];
+			for(int b = 0; b < 4; b++)
+				p[b] = (c[b] + LAMBDA * prob(K - 1, (4 * counts.context(s) + b) & lower)) / (n + LAMBDA);
+		}
+		counts.clear();
 	}
 }
 
-void BGModel::calc_bg_scores_2() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
-	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		wbgscores[i].clear();
-		cbgscores[i].clear();
-		wbgscores[i].reserve(len);
-		cbgscores[i].reserve(len);
-		
-		// Use lower order models for first two Watson bases
-		wbgscores[i].push_back(log(model0[seq[i][0]]));
-		wbgscores[i].push_back(log(model1[seq[i][0] * 4 
-															+ seq[i][1]]));
-				
-		// Use 2nd order model for most bases
-		for(int j = 2; j < len; j++) {
-			wbgscores[i].push_back(log(model2[seq[i][j - 2] * 16 
-																+ seq[i][j - 1] * 4
-																+ seq[i][j]]));
-		}
-		for(int j = 0; j < len - 2; j++) {
-			cbgscores[i].push_back(log(model2[(3 - seq[i][j + 2]) * 16
-																+ (3 - seq[i][j + 1]) * 4
-																+ (3 - seq[i][j])]));
-		}
-		
-		// Use lower order models for last two Crick bases
-		cbgscores[i].push_back(log(model1[(3 - seq[i][len - 1]) * 4 
-															+ (3 - seq[i][len - 2])]));
-		cbgscores[i].push_back(log(model0[3 - seq[i][len - 1]]));
-	
-		assert(wbgscores[i].size() == (unsigned int) len);
-		assert(cbgscores[i].size() == (unsigned int) len);
-	}
+template<> void BGModel::train_order<0>() {
+	// Just use genome-wide GC content
+	model[0][0] = (1 - gc_genome)/2;
+	model[0][1] = gc_genome/2;
+	model[0][2] = model[0][1];
+	model[0][3] = model[0][0];
 }
 
-void BGModel::calc_bg_scores_1() {
-	const vector<vector <char> >& seq = seqset.seq();
-	int ss_num_seqs = seqset.num_seqs();
+// Score every base with the rolling indexes of count_kmers(). Bases with
+// fewer than K bases before them (Watson) or after them (Crick) in their
+// sequence are scored with the highest order model that fits.
+template<int K> void BGModel::score_order() {
+	const unsigned long mask = (1UL << (2 * (K + 1))) - 1;
+	wbg_store.assign(seqset.total_len(), 0);
+	cbg_store.assign(seqset.total_len(), 0);
 	
-	int len;
-	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		wbgscores[i].clear();
-		cbgscores[i].clear();
-		wbgscores[i].reserve(len);
-		cbgscores[i].reserve(len);
-		
-		// Use 0th order model for first Watson base
-		wbgscores[i].push_back(log(model0[seq[i][0]]));
-				
-		// Use 1st-order model for most bases
-		for(int j = 1; j < len; j++) {
-			wbgscores[i].push_back(log(model1[seq[i][j - 1] * 4
-																+ seq[i][j]]));
-		}
-		for(int j = 0; j < len - 1; j++) {
-			cbgscores[i].push_back(log(model1[(3 - seq[i][j + 1]) * 4
-																+ (3 - seq[i][j])]));
-		}
-		
-		// Use 0th order model for last Crick base
-		cbgscores[i].push_back(log(model0[3 - seq[i][len - 1]]));
-	
-		assert(wbgscores[i].size() == (unsigned int) len);
-		assert(cbgscores[i].size() == (unsigned int) len);
-	}
-}
-
-void BGModel::calc_bg_scores_0() {
-	const vector<vector <char> >& seq = seqset.seq();
 	int ss_num_seqs = seqset.num_seqs();
-	
-	int len;
 	for(int i = 0; i < ss_num_seqs; i++) {
-		len = seq[i].size();
-		wbgscores[i].clear();
-		cbgscores[i].clear();
-		wbgscores[i].reserve(len);
-		cbgscores[i].reserve(len);
-		
-		// Use 0th order model for all bases
-		for(int j = 0; j < len; j++) {
-			wbgscores[i].push_back(log(model0[seq[i][j]]));
+		int len = seqset.len_seq(i);
+		float* wbg = &wbg_store[seqset.offset(i)];
+		float* cbg = &cbg_store[seqset.offset(i)];
+		unsigned long w = 0, c = 0;
+		for(int j = 0; j < len; j += 32) {
+			uint64_t bases = seqset.word(i, j);
+			int n = min(32, len - j);
+			for(int k = 0; k < n; k++, bases >>= 2) {
+				unsigned long b = bases & 3;
+				w = ((w << 2) | b) & mask;
+				c = (c >> 2) | ((3 - b) << (2 * K));
+				if(j + k >= K) {
+					wbg[j + k] = log(prob(K, w));
+					cbg[j + k - K] = log(prob(K, c));
+				} else {
+					wbg[j + k] = log(prob(j + k, w));
+				}
+			}
 		}
-		for(int j = 0; j < len; j++) {
-			cbgscores[i].push_back(log(model0[(3 - seq[i][j])]));
+		// The last bases of the Crick strand, with the oldest bases shifted out of c
+		for(int p = max(0, len - K); p < len; p++) {
+			int o = len - 1 - p;
+			cbg[p] = log(prob(o, c >> (2 * (K - o))));
 		}
-		
-		assert(wbgscores[i].size() == (unsigned int) len);
-		assert(cbgscores[i].size() == (unsigned int) len);
 	}
 }
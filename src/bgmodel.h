@@ -2,46 +2,117 @@
 #define _bgmodel
 
 #include "seqset.h"
+#include "kmertable.h"
 
 class BGModel {
 	const Seqset& seqset;
-	int total_seq_len;
+	long total_seq_len;
 	int order;
 	float gc_genome;
 	vector<float> gc;
-	vector<float> model0;
-	vector<float> model1;
-	vector<float> model2;
-	vector<float> model3;
-	vector<float> model4;
-	vector<float> model5;
-	vector<vector <float> > wbgscores;
-	vector<vector <float> > cbgscores;
-	vector<vector <float> > cumulscores;
-	void (BGModel::*train_background[6])();
-	void (BGModel::*calc_bg_scores[6])();
+	static const int MAX_ORDER = 10;
+	static const int DENSE_ORDER = 7;                              // higher orders only store contexts that occur
+	static const int LAMBDA = 10;                                  // weight of the lower order model in orders above 5
+	vector<float> model[DENSE_ORDER + 1];                          // model[k] holds P(base | k previous bases), by (k+1)-mer
+	KmerTable<float> sparse[MAX_ORDER - DENSE_ORDER];              // the same for orders above DENSE_ORDER, by k-mer context
+	KmerTable<unsigned long> sparse_counts[MAX_ORDER - DENSE_ORDER];   // counts for sparse, until trained into it
+	const float* wbgscores;                                        // Watson background scores, by global position
+	const float* cbgscores;                                        // Crick background scores, by global position
+	const double* wcumul;                                          // running sums of wbgscores, wcumul[i] = sum before position i
+	const double* ccumul;                                          // the same for cbgscores, in the same order
+	vector<float> wbg_store;                                       // storage for the above when not a view of shared memory
+	vector<float> cbg_store;
+	vector<double> wcumul_store;
+	vector<double> ccumul_store;
+	bool lean;                                                     // whether scores are computed while scanning, not stored
+	vector<float> logmodel[DENSE_ORDER + 1];                       // log of model, for lean scoring
+	vector<int> block_seq;                                         // sequence holding the first base of each 1024 bases,
+	                                                               // to find the sequence of a window when lean scoring
+	static const long CHUNK_BASES = 1 << 24;                       // bases per chunk when training on a FASTA file
+	struct KmerCounts;                                             // k-mer counts of every order for part of the sequences
+	struct CountJob;
+	class ChunkSink;
+	void (BGModel::*count_background[MAX_ORDER + 1])(const Seqset& s, const long from, const long to, const int skip,
+			KmerCounts& counts) const;
+	void (BGModel::*train_background[MAX_ORDER + 1])();
+	void (BGModel::*calc_bg_scores[MAX_ORDER + 1])();
 
-	void train_background_5();                                     // Train 5th order background model
-	void train_background_4();                                     // Train 4th order background model
-	void train_background_3();                                     // Train 3rd order background model
-	void train_background_2();                                     // Train 2nd order background model
-	void train_background_1();                                     // Train 1st order background model
-	void train_background_0();                                     // Train 0th order background model
-	void calc_bg_scores_5();                                       // Calculate scores using 5th order background model
-	void calc_bg_scores_4();                                       // Calculate scores using 4th order background model
-	void calc_bg_scores_3();                                       // Calculate scores using 3rd order background model
-	void calc_bg_scores_2();                                       // Calculate scores using 2nd order background model
-	void calc_bg_scores_1();                                       // Calculate scores using 1st order background model
-	void calc_bg_scores_0();                                       // Calculate scores using 0th order background model
+	void set_functions();                                          // Fill in the training/scoring function tables
+	void init_models();                                            // Size the model tables
+	void calc_gc();                                                // Calculate GC content of each sequence
+	void calc_scores();                                            // Calculate background scores for every position
+	void read_tables(istream& in);                                 // Read trained tables written by write_tables()
+	BGModel(const Seqset& none, const char* filename, const int ord, const int nthreads);   // Train on a FASTA file, without scores
+	void count_all(const int nthreads);                            // Count k-mers of all orders, leaving the counts in the models
+	void init_counts(KmerCounts& counts) const;                    // Size the tables of a set of counts
+	static void run_jobs(CountJob* jobs, const int n);             // Count n jobs, each on its own thread
+	void merge_dense(vector<CountJob>& jobs);                      // Set the dense models to the sum of the jobs' counts
+	void merge_sparse(vector<CountJob>& jobs);                     // Add the jobs' hashed counts to sparse_counts and clear them
+	static void* count_thread(void* arg);
+	template<int K> void count_kmers(const Seqset& s, const long from, const long to, const int skip,
+			KmerCounts& counts) const;                                 // Count (k+1)-mers for k <= K on both strands
+	template<int K> void train_order();                            // Turn the order K counts into a model
+	template<int K> void train_interpolated();                     // The same for orders above 5, backing off to order K-1
+	template<int K> void score_order();                            // Calculate scores using models up to order K
+	float log_prob(const int k, const unsigned long w) const {     // Return the log of prob() for a (k+1)-mer, masking off
+		const unsigned long m = w & ((1UL << (2 * (k + 1))) - 1);    // older bases
+		return k <= DENSE_ORDER ? logmodel[k][m] : log(prob(k, m));
+	}
+	double lean_score(const vector<pair<int, int> >& runs, const int width, const long gp, const bool s) const;
 
 public:
-	BGModel(const Seqset& s, const int ord = 3);
+	BGModel(const Seqset& s, const int ord = 3, const int nthreads = 1, const bool lean_scores = false);
+	                                                               // Train, counting on nthreads threads; with lean_scores,
+	                                                               // score windows from the tables instead of storing scores
+	BGModel(const Seqset& s, istream& tables, const bool lean_scores = false);   // Use previously trained tables
+	BGModel(const Seqset& s, istream& tables, const float* wbg, const float* cbg,
+			const double* wcum, const double* ccum);                    // Also use precomputed scores and sums
+	void write_tables(ostream& out) const;                        // Write the trained tables in binary form
+	bool write_file(const char* filename) const;                  // Save the trained tables for other runs
+	static bool read_file(const char* filename, string& tables);  // Load tables saved by write_file(), for the istream constructor
+	static int tables_order(const string& tables);                // Return the order of tables written by write_tables()
+	static string train_file(const char* filename, const int ord, const int nthreads);   // Return tables trained on a FASTA
+	                                                                                    // file of any size, read in chunks
+	int get_order() const { return order; }
+	static int max_order() { return MAX_ORDER; }
+	float prob(int k, unsigned long w) const {                     // Return P(last base | k before it) for a (k+1)-mer
+		for(; k > DENSE_ORDER; k--) {                                // Contexts never seen fall back to lower orders
+			const float* p = sparse[k - DENSE_ORDER - 1].find(w >> 2);
+			if(p != NULL) return p[w & 3];
+			w &= (1UL << (2 * k)) - 1;
+		}
+		return model[k][w];
+	}
 	float tot_seq_len() const { return total_seq_len; }           // Return total length of all sequences
 	float gcgenome() const { return gc_genome; }                  // Return overall GC content
 	float gccontent(const int i) const { return gc[i]; }          // Return GC content of a specified sequence
-	double score_site(vector<int>::const_iterator first_col, vector<int>::const_iterator last_col, const int width, const int c, const int p, const bool s) const;
-	vector<vector <float> > const& get_cumulscores() const { return cumulscores; }
+	static void column_runs(vector<int>::const_iterator first_col, vector<int>::const_iterator last_col,
+			vector<pair<int, int> >& runs);                           // Find the runs [start, end) of consecutive columns
+	double score_site(const vector<pair<int, int> >& runs, const int width, const long gp, const bool s) const {
+		if(lean) return lean_score(runs, width, gp, s);
+		double L = 0.0;                                              // Return the score of a window's columns, by runs
+		vector<pair<int, int> >::const_iterator ri = runs.begin(), re = runs.end();
+		if(s) {
+			const double* wc = &wcumul[gp];
+			for(; ri != re; ++ri)
+				L += wc[ri->second] - wc[ri->first];
+		} else {
+			const double* cc = &ccumul[gp + width];                    // column c is at gp + width - 1 - c
+			for(; ri != re; ++ri)
+				L += cc[- ri->first] - cc[- ri->second];
+		}
+		return L;
+	}
+	const float* watson_scores() const { return wbgscores; }       // Raw scores, for sharing between processes
+	const float* crick_scores() const { return cbgscores; }
+	const double* watson_cumul() const { return wcumul; }
+	const double* crick_cumul() const { return ccumul; }
+	bool has_scores() const { return wbgscores != NULL; }         // Whether there are stored scores to share
+	bool folded() const { return order == 0; }                     // Whether the background goes into score matrices instead,
+	                                                               // through fold(), so that score_site() is not needed
+	void fold(double* sm, const int ncols) const;                  // Subtract an order 0 background from a score matrix
 };
 
+template<> void BGModel::train_order<0>();
 
 #endif
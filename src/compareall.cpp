@@ -2,22 +2,35 @@
 #include "archivesites.h"
 
 int main(int argc, char** argv) {
+	if(argc < 3) {
+		cout << "Usage: compareall seqfile archivefile [bgfile]\n";
+		cout << " Prints the similarity of every pair of motifs in an archive written by motifspec;\n";
+		cout << " bgfile is a background model saved by motifspec -bgout, giving the GC content.\n";
+		exit(0);
+	}
 	string seqfile(argv[1]);
 	string acefile(argv[2]);
 	
 	vector<string> seqs;
 	get_fasta_fast(seqfile.c_str(), seqs);
 	Seqset seqset(seqs);
-	BGModel bgm(seqset, 0);
+	string tables;                        // optional background saved by motifspec -bgout
+	if(argc > 3 && ! BGModel::read_file(argv[3], tables)) {
+		cerr << "Invalid background model file '" << argv[3] << "'\n";
+		exit(1);
+	}
+	istringstream tablestream(tables);
+	BGModel* bgp = tables.empty() ? new BGModel(seqset, 0) : new BGModel(seqset, tablestream, true);
+	BGModel& bgm = *bgp;                  // only its GC content is used, so it keeps no scores
 	vector<double> backfreq(4);
 	backfreq[0] = backfreq[3] = (1 - bgm.gcgenome())/2.0;
 	backfreq[1] = backfreq[2] = bgm.gcgenome()/2.0;
 	vector<double> pseudo(backfreq);
-	ArchiveSites archive(seqset, bgm, 0.8, pseudo, backfreq);
+	ArchiveSites archive(seqset, 0.8, INT_MAX, pseudo, backfreq);
 	ifstream acestream(acefile.c_str());
 	archive.read(acestream);
 	acestream.close();
-	MotifCompare mc(seqset, bgm);
+	MotifCompare mc;
 	
 	vector<Motif> mots(archive.get_archive());
 	int nmots = mots.size();
@@ -27,4 +40,5 @@ int main(int argc, char** argv) {
 			cout << acefile << '\t' << i + 1 << '\t' << acefile << '\t' << j + 1 << '\t' << c << '\n';
 		}
 	}
+	delete bgp;
 }
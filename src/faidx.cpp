@@ -0,0 +1,78 @@
+#include <sys/mman.h>
+#include "faidx.h"
+
+bool FastaIndex::open(const char* filename) {
+	string idxname = string(filename) + ".fai";
+	ifstream idx(idxname.c_str());
+	if(! idx) {
+		cerr << "No index '" << idxname << "', please create it with 'samtools faidx'\n";
+		return false;
+	}
+	if(! map.open(filename)) {
+		cerr << "No such file '" << filename << "'\n";
+		return false;
+	}
+	const unsigned char* data = (const unsigned char*) map.data();
+	if(map.size() >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+		cerr << "Reference '" << filename << "' must not be compressed\n";
+		map.close();
+		return false;
+	}
+	madvise((void*) map.data(), map.size(), MADV_RANDOM);
+	string line;
+	while(getline(idx, line)) {
+		if(line.empty()) continue;
+		vector<string> f = split(line, '\t');
+		if(f.size() < 5) continue;
+		Entry e;
+		e.length = atol(f[1].c_str());
+		e.offset = atol(f[2].c_str());
+		e.linebases = atol(f[3].c_str());
+		e.linewidth = atol(f[4].c_str());
+		if(e.linebases <= 0 || e.linewidth < e.linebases
+				|| (e.length > 0 && file_offset(e, e.length - 1) >= (long) map.size())) {
+			cerr << "Index '" << idxname << "' does not match '" << filename << "'\n";
+			map.close();
+			return false;
+		}
+		entries[f[0]] = e;
+	}
+	return true;
+}
+
+bool FastaIndex::extract(const string& chrom, const long start, const long end, FastaSink& sink) const {
+	std::map<string, Entry>::const_iterator it = entries.find(chrom);
+	if(it == entries.end() || start < 1 || end < start || end > it->second.length) return false;
+	// Line ends inside the span are whitespace, which the sink skips
+	const long first = file_offset(it->second, start - 1);
+	const long last = file_offset(it->second, end - 1);
+	sink.bases(map.data() + first, last - first + 1);
+	return true;
+}
+
+void read_positions(const char* posfile, const char* reffile, Seqset& seqset, vector<string>& nameset) {
+	FastaIndex ref;
+	if(! ref.open(reffile)) exit(1);
+	vector<string> lines;
+	get_list(posfile, lines);
+	SeqsetSink sink(seqset, nameset);
+	for(unsigned int i = 0; i < lines.size(); i++) {
+		const string name = clip_white(lines[i]);
+		if(name.empty()) continue;
+		const size_t colon = name.rfind(':');
+		const size_t dash = (colon == string::npos) ? string::npos : name.find('-', colon);
+		if(dash == string::npos) {
+			cerr << "Invalid position '" << name << "' in '" << posfile << "'\n";
+			exit(1);
+		}
+		const string chrom = name.substr(0, colon);
+		const long start = atol(name.substr(colon + 1, dash - colon - 1).c_str());
+		const long end = atol(name.substr(dash + 1).c_str());
+		sink.begin_record(name);
+		if(! ref.extract(chrom, start, end, sink)) {
+			cerr << "Position '" << name << "' is not in '" << reffile << "'\n";
+			exit(1);
+		}
+		sink.end_record();
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef _faidx
+#define _faidx
+
+#include "standard.h"
+#include "fasta.h"
+#include "mappedfile.h"
+
+// Indexed reference FASTA (samtools faidx .fai format), mapped for random access
+class FastaIndex {
+	struct Entry {
+		long length;                                                // number of bases
+		long offset;                                                // file offset of the first base
+		long linebases;                                             // bases per line
+		long linewidth;                                             // bytes per line, including the line end
+	};
+
+	MappedFile map;
+	std::map<string, Entry> entries;
+
+	long file_offset(const Entry& e, const long p) const {      // Return the file offset of a 0-based position
+		return e.offset + (p / e.linebases) * e.linewidth + p % e.linebases;
+	}
+
+public:
+	bool open(const char* filename);                            // Map a reference and read filename.fai
+	bool extract(const string& chrom, const long start, const long end, FastaSink& sink) const;   // Pass bases start..end (1-based, inclusive) to a sink
+};
+
+// Extract the regions listed in a .pos file ("chr:start-end" per line) into a Seqset
+void read_positions(const char* posfile, const char* reffile, Seqset& seqset, vector<string>& nameset);
+
+#endif
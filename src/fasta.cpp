@@ -0,0 +1,245 @@
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "fasta.h"
+#include "mappedfile.h"
+
+FastaParser::FastaParser(FastaSink& s) :
+sink(s),
+in_header(false),
+in_record(false),
+line_start(true) {
+}
+
+void FastaParser::parse(const char* buf, const long n) {
+	const char* p = buf;
+	const char* end = buf + n;
+	while(p < end) {
+		if(in_header) {
+			const char* nl = (const char*) memchr(p, '\n', end - p);
+			if(nl == NULL) {
+				name.append(p, end - p);
+				return;
+			}
+			name.append(p, nl - p);
+			if(! name.empty() && name[name.length() - 1] == '\r')
+				name.erase(name.length() - 1);
+			sink.begin_record(name);
+			in_header = false;
+			in_record = true;
+			line_start = true;
+			p = nl + 1;
+			continue;
+		}
+		if(line_start && *p == '>') {
+			if(in_record) sink.end_record();
+			in_record = false;
+			in_header = true;
+			name.clear();
+			p++;
+			continue;
+		}
+		// Sequence line, or the part of it in this buffer
+		const char* nl = (const char*) memchr(p, '\n', end - p);
+		const char* stop = (nl == NULL) ? end : nl;
+		if(in_record) sink.bases(p, stop - p);
+		line_start = (nl != NULL);
+		p = (nl == NULL) ? end : nl + 1;
+	}
+}
+
+void FastaParser::finish() {
+	if(in_header) {
+		if(! name.empty() && name[name.length() - 1] == '\r')
+			name.erase(name.length() - 1);
+		sink.begin_record(name);
+		in_header = false;
+		in_record = true;
+	}
+	if(in_record) sink.end_record();
+	in_record = false;
+	line_start = true;
+}
+
+void SeqsetSink::end_record() {
+	if(seqset.building_len() == 0) {
+		cerr << "\t\tSkipping empty sequence '" << nameset.back() << "'\n";
+		nameset.pop_back();
+		return;
+	}
+	seqset.end_seq();
+}
+
+// BGZF blocks are gzip members whose extra field gives the compressed block size
+struct BgzfBlock {
+	const unsigned char* data;                                    // raw deflate data
+	long len;                                                     // bytes of raw deflate data
+	unsigned int crc;
+	long isize;                                                   // uncompressed size
+	long out;                                                     // offset in the batch buffer
+};
+
+struct BgzfBatch {
+	const BgzfBlock* blocks;
+	int nblocks;
+	char* buf;
+	int nthreads;
+	int thread;
+	bool failed;
+};
+
+static unsigned int get_le(const unsigned char* p, const int n) {
+	unsigned int v = 0;
+	for(int i = n - 1; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+}
+
+// Return the size of the BGZF block at p, or 0 if it is not one
+static long bgzf_block_size(const unsigned char* p, const long avail) {
+	if(avail < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || ! (p[3] & 4)) return 0;
+	const long xlen = get_le(p + 10, 2);
+	const unsigned char* x = p + 12;
+	const unsigned char* xend = x + xlen;
+	if(12 + xlen > avail) return 0;
+	while(x + 4 <= xend) {
+		const long slen = get_le(x + 2, 2);
+		if(x[0] == 'B' && x[1] == 'C' && slen == 2 && x + 6 <= xend) {
+			const long bsize = get_le(x + 4, 2) + 1;
+			return (bsize <= avail && bsize >= 12 + xlen + 8) ? bsize : 0;
+		}
+		x += 4 + slen;
+	}
+	return 0;
+}
+
+static void* inflate_blocks(void* arg) {
+	BgzfBatch* b = (BgzfBatch*) arg;
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if(inflateInit2(&zs, -15) != Z_OK) {
+		b->failed = true;
+		return NULL;
+	}
+	for(int i = b->thread; i < b->nblocks; i += b->nthreads) {
+		const BgzfBlock& blk = b->blocks[i];
+		inflateReset(&zs);
+		zs.next_in = (Bytef*) blk.data;
+		zs.avail_in = blk.len;
+		zs.next_out = (Bytef*) (b->buf + blk.out);
+		zs.avail_out = blk.isize;
+		int ret = inflate(&zs, Z_FINISH);
+		if(ret != Z_STREAM_END || zs.total_out != (unsigned long) blk.isize
+				|| crc32(0L, (const Bytef*) (b->buf + blk.out), blk.isize) != blk.crc) {
+			b->failed = true;
+			break;
+		}
+	}
+	inflateEnd(&zs);
+	return NULL;
+}
+
+// Decompress BGZF input in batches of blocks, inflating each batch on several threads
+static void read_bgzf(const char* filename, const unsigned char* data, const long size,
+		FastaParser& parser, FastaSink& sink, const int nthreads) {
+	vector<BgzfBlock> blocks;
+	long total = 0;
+	for(long pos = 0; pos < size;) {
+		const long bsize = bgzf_block_size(data + pos, size - pos);
+		if(bsize == 0) {
+			cerr << "Invalid BGZF block in '" << filename << "' at offset " << pos << "\n";
+			exit(1);
+		}
+		BgzfBlock blk;
+		const long xlen = get_le(data + pos + 10, 2);
+		blk.data = data + pos + 12 + xlen;
+		blk.len = bsize - 12 - xlen - 8;
+		blk.crc = get_le(data + pos + bsize - 8, 4);
+		blk.isize = get_le(data + pos + bsize - 4, 4);
+		blocks.push_back(blk);
+		total += blk.isize;
+		pos += bsize;
+	}
+	sink.reserve(total);
+
+	const int batch_blocks = 256 * nthreads;
+	vector<char> buf;
+	vector<pthread_t> threads(nthreads);
+	vector<BgzfBatch> work(nthreads);
+	for(unsigned int first = 0; first < blocks.size(); first += batch_blocks) {
+		const int n = min((unsigned int) batch_blocks, (unsigned int) blocks.size() - first);
+		long len = 0;
+		for(int i = 0; i < n; i++) {
+			blocks[first + i].out = len;
+			len += blocks[first + i].isize;
+		}
+		if(len == 0) continue;
+		buf.resize(len);
+		for(int t = 0; t < nthreads; t++) {
+			work[t].blocks = &blocks[first];
+			work[t].nblocks = n;
+			work[t].buf = &buf[0];
+			work[t].nthreads = nthreads;
+			work[t].thread = t;
+			work[t].failed = false;
+		}
+		for(int t = 1; t < nthreads; t++)
+			if(pthread_create(&threads[t], NULL, inflate_blocks, &work[t]) != 0) {
+				cerr << "Unable to start decompression thread\n";
+				exit(1);
+			}
+		inflate_blocks(&work[0]);
+		for(int t = 1; t < nthreads; t++) pthread_join(threads[t], NULL);
+		for(int t = 0; t < nthreads; t++)
+			if(work[t].failed) {
+				cerr << "Corrupt compressed data in '" << filename << "'\n";
+				exit(1);
+			}
+		parser.parse(&buf[0], len);
+	}
+}
+
+// Decompress ordinary gzip input, which can only be inflated serially
+static void read_gzip(const char* filename, FastaParser& parser) {
+	gzFile gz = gzopen(filename, "rb");
+	if(gz == NULL) {
+		cerr << "No such file '" << filename << "'\n";
+		exit(0);
+	}
+	gzbuffer(gz, 1 << 17);
+	vector<char> buf(1 << 20);
+	int n;
+	while((n = gzread(gz, &buf[0], buf.size())) > 0)
+		parser.parse(&buf[0], n);
+	if(n < 0) {
+		int err;
+		cerr << "Corrupt compressed data in '" << filename << "': " << gzerror(gz, &err) << "\n";
+		exit(1);
+	}
+	gzclose(gz);
+}
+
+void read_fasta(const char* filename, Seqset& seqset, vector<string>& nameset, const int nthreads) {
+	SeqsetSink sink(seqset, nameset);
+	read_fasta(filename, sink, nthreads);
+}
+
+void read_fasta(const char* filename, FastaSink& sink, const int nthreads) {
+	MappedFile map;
+	if(! map.open(filename)) {
+		cerr << "No such file '" << filename << "'\n";
+		exit(0);
+	}
+	madvise((void*) map.data(), map.size(), MADV_SEQUENTIAL);
+	FastaParser parser(sink);
+	const unsigned char* data = (const unsigned char*) map.data();
+	if(bgzf_block_size(data, map.size()) > 0) {
+		read_bgzf(filename, data, map.size(), parser, sink, max(nthreads, 1));
+	} else if(map.size() >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+		map.close();
+		read_gzip(filename, parser);
+	} else {
+		sink.reserve(map.size());
+		parser.parse(map.data(), map.size());
+	}
+	parser.finish();
+}
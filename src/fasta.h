@@ -0,0 +1,48 @@
+#ifndef _fasta
+#define _fasta
+
+#include "standard.h"
+#include "seqset.h"
+
+// Receives the records found by a FastaParser
+class FastaSink {
+public:
+	virtual ~FastaSink() {};
+	virtual void begin_record(const string& name) = 0;            // Start of a record, with the header text after '>'
+	virtual void bases(const char* s, const long n) = 0;          // Part of a sequence line (may include '\r')
+	virtual void end_record() = 0;                                // End of a record
+	virtual void reserve(const long) {};                          // Roughly how many bases will follow, when known
+};
+
+// Incremental FASTA parser: input may be split anywhere, including inside a header or a line
+class FastaParser {
+	FastaSink& sink;
+	string name;                                                  // header being read
+	bool in_header;
+	bool in_record;
+	bool line_start;
+
+public:
+	FastaParser(FastaSink& s);
+	void parse(const char* buf, const long n);                    // Parse the next piece of input
+	void finish();                                                // Flush the last record at end of input
+};
+
+// Adds FASTA records to a Seqset and their names to a list
+class SeqsetSink : public FastaSink {
+	Seqset& seqset;
+	vector<string>& nameset;
+
+public:
+	SeqsetSink(Seqset& s, vector<string>& names) : seqset(s), nameset(names) {};
+	void begin_record(const string& name) { nameset.push_back(name); };
+	void bases(const char* s, const long n) { seqset.append(s, n); };
+	void end_record();                                            // Skips a record with no bases, with a warning
+	void reserve(const long n) { seqset.reserve(n); };
+};
+
+// Read plain, gzip or BGZF compressed FASTA; BGZF blocks are decompressed on nthreads threads
+void read_fasta(const char* filename, Seqset& seqset, vector<string>& nameset, const int nthreads = 1);
+void read_fasta(const char* filename, FastaSink& sink, const int nthreads = 1);   // The same, passing the records to a sink
+
+#endif
@@ -11,3 +11,15 @@ double fastexp(double y) {
 
 	return eco.d;
 }
+
+// fastexp() is below L when the integer it builds is below the high word of
+// L, which holds for arguments at least one unit of that integer short of it.
+// Nothing is surely below a ratio of 0 or less.
+double fastexp_floor(double L) {
+	union expun eco;
+
+	if(! (L > 0)) return -HUGE_VAL;
+	eco.d = L;
+
+	return ((double) eco.n.i - 1072632448.0) / 1512775;
+}
@@ -7,4 +7,5 @@ union expun {
 
 
 double fastexp(double y);
+double fastexp_floor(double L);          // Return an argument below which fastexp() is surely below L
 
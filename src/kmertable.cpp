@@ -0,0 +1,81 @@
+#include "kmertable.h"
+
+template<typename T> KmerTable<T>::KmerTable() {
+	clear();
+}
+
+template<typename T> void KmerTable<T>::clear() {
+	keys.assign(1024, 0);
+	values.assign(4 * 1024, 0);
+	used = 0;
+	shift = 54;
+}
+
+template<typename T> long KmerTable<T>::slot(const unsigned long ctx) const {
+	const unsigned long key = ctx + 1;
+	const long m = keys.size() - 1;
+	long s = (key * 0x9E3779B97F4A7C15UL) >> shift;
+	while(keys[s] != 0 && keys[s] != key)
+		s = (s + 1) & m;
+	return s;
+}
+
+template<typename T> T* KmerTable<T>::insert(const unsigned long ctx) {
+	long s = slot(ctx);
+	if(keys[s] == 0) {
+		// Keep the table at most half full
+		if(2 * (used + 1) > (long) keys.size()) {
+			grow();
+			s = slot(ctx);
+		}
+		keys[s] = ctx + 1;
+		used++;
+	}
+	return &values[4 * s];
+}
+
+template<typename T> void KmerTable<T>::grow() {
+	vector<unsigned long> oldkeys;
+	vector<T> oldvalues;
+	swap(keys, oldkeys);
+	swap(values, oldvalues);
+	keys.assign(2 * oldkeys.size(), 0);
+	values.assign(2 * oldvalues.size(), 0);
+	shift--;
+	for(unsigned long i = 0; i < oldkeys.size(); i++) {
+		if(oldkeys[i] == 0) continue;
+		long s = slot(oldkeys[i] - 1);
+		keys[s] = oldkeys[i];
+		memcpy(&values[4 * s], &oldvalues[4 * i], 4 * sizeof(T));
+	}
+}
+
+template<typename T> void KmerTable<T>::write(ostream& out) const {
+	out.write((const char*) &used, sizeof(used));
+	for(unsigned long i = 0; i < keys.size(); i++) {
+		if(keys[i] == 0) continue;
+		unsigned long ctx = keys[i] - 1;
+		out.write((const char*) &ctx, sizeof(ctx));
+		out.write((const char*) &values[4 * i], 4 * sizeof(T));
+	}
+}
+
+template<typename T> bool KmerTable<T>::read(istream& in) {
+	clear();
+	long n;
+	in.read((char*) &n, sizeof(n));
+	if(! in || n < 0) return false;
+	for(long i = 0; i < n; i++) {
+		unsigned long ctx;
+		T v[4];
+		in.read((char*) &ctx, sizeof(ctx));
+		in.read((char*) v, sizeof(v));
+		if(! in) return false;
+		memcpy(insert(ctx), v, sizeof(v));
+	}
+	return true;
+}
+
+template class KmerTable<float>;
+template class KmerTable<unsigned int>;
+template class KmerTable<unsigned long>;
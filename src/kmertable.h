@@ -0,0 +1,36 @@
+#ifndef _kmertable
+#define _kmertable
+
+#include "standard.h"
+
+// Open-addressing hash table from a k-mer context to four values, one per next base.
+// Used for high-order background models, where most contexts never occur. Counts are
+// kept in integer tables, as a float stops incrementing at 2^24, and converted into
+// float tables of probabilities once counting is done.
+template<typename T> class KmerTable {
+	vector<unsigned long> keys;                                   // context + 1, or 0 for an empty slot
+	vector<T> values;                                             // four per slot
+	long used;                                                    // number of occupied slots
+	int shift;                                                    // 64 - log2 of the number of slots
+
+	long slot(const unsigned long ctx) const;                     // Return the slot holding ctx, or the empty slot for it
+	void grow();                                                  // Double the number of slots
+
+public:
+	KmerTable();
+	const T* find(const unsigned long ctx) const {            // Return the values for a context, or NULL
+		long s = slot(ctx);
+		return keys[s] != 0 ? &values[4 * s] : NULL;
+	}
+	T* insert(const unsigned long ctx);                       // Return the values for a context, adding zeros if new
+	long size() const { return used; }
+	long capacity() const { return keys.size(); }
+	bool occupied(const long s) const { return keys[s] != 0; }    // Slot-wise access, for converting and writing
+	unsigned long context(const long s) const { return keys[s] - 1; }
+	T* slot_values(const long s) { return &values[4 * s]; }
+	void clear();
+	void write(ostream& out) const;
+	bool read(istream& in);
+};
+
+#endif
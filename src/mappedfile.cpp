@@ -0,0 +1,51 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mappedfile.h"
+
+MappedFile::MappedFile() :
+fd(-1),
+addr(NULL),
+len(0) {
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const char* filename) {
+	close();
+	fd = ::open(filename, O_RDONLY);
+	return map_fd();
+}
+
+bool MappedFile::open_shared(const char* name) {
+	close();
+	fd = shm_open(name, O_RDONLY, 0);
+	return map_fd();
+}
+
+bool MappedFile::map_fd() {
+	if(fd == -1) return false;
+	struct stat st;
+	if(fstat(fd, &st) == -1 || st.st_size == 0) {
+		close();
+		return false;
+	}
+	len = st.st_size;
+	void* a = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if(a == MAP_FAILED) {
+		close();
+		return false;
+	}
+	addr = (char*) a;
+	return true;
+}
+
+void MappedFile::close() {
+	if(addr != NULL) munmap(addr, len);
+	if(fd != -1) ::close(fd);
+	fd = -1;
+	addr = NULL;
+	len = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _mappedfile
+#define _mappedfile
+
+#include "standard.h"
+
+// Read-only memory mapping of a whole file or shared memory object
+class MappedFile {
+	int fd;
+	char* addr;
+	size_t len;
+
+	bool map_fd();                                                // Map the whole of the open file
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator= (const MappedFile&);
+
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const char* filename);                              // Map a file, returns false if it cannot be mapped
+	bool open_shared(const char* name);                           // Map a POSIX shared memory object
+	void close();                                                 // Unmap the file
+	bool is_open() const { return addr != NULL; }
+	const char* data() const { return addr; }
+	size_t size() const { return len; }
+};
+
+#endif
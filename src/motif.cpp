@@ -134,7 +134,6 @@ void Motif::add_site(const int c, const int p, const bool s){
 }
 
 void Motif::column_freq(const int col, int *ret){
-	const vector<vector <char> >& seq = seqset.seq();
 	for(int i = 0; i < 4; i++) ret[i] = 0;
 	int c, p, len;
 	bool s;
@@ -148,41 +147,15 @@ void Motif::column_freq(const int col, int *ret){
 		if(s) {
 			assert(p + col >= 0);
 			assert(p + col < len);
-			ret[(int) seq[c][p + col]]++;
+			ret[(int) seqset.base(c, p + col)]++;
 		} else {
 			assert(p + width - 1 - col >= 0);
 			assert(p + width - 1 - col < len);
-			ret[3 - seq[c][p + width - 1 - col]]++;
+			ret[3 - seqset.base(c, p + width - 1 - col)]++;
 		}
 	}
 }
 
-double Motif::score_site(double* score_matrix, const int c, const int p, const bool s) const {
-	const vector<vector <char> >& seq = seqset.seq();
-	double L = 0.0;
-	int matpos;
-	vector<int>::const_iterator ci= columns.begin();
-	vector<int>::const_iterator ce = columns.end();
-	if(s) {
-		matpos = 0;
-		for(; ci != ce; ++ci) {
-			assert(p + *ci >= 0);
-			assert(p + *ci < seqset.len_seq(c));
-			L += score_matrix[matpos + seq[c][p + *ci]];
-			matpos += 4;
-		}
-	} else {
-		matpos = 0;
-		for(; ci != ce; ++ci) {
-			assert(p + width - 1 - *ci >= 0);
-			assert(p + width - 1 - *ci < seqset.len_seq(c));
-			L += score_matrix[matpos + 3 - seq[c][p + width - 1 - *ci]];
-			matpos += 4;
-		}
-	}
-	return L;
-}
-
 void Motif::add_col(const int c) {
 	if(c == 0) {
 		assert(columns.size() == 0);
@@ -387,18 +360,24 @@ void Motif::orient() {
 	delete [] freq;
 }
 
-int Motif::total_positions() const {
-	int ret = 0;
-	for(int i = 0; i < num_seqs; i++)
-		ret += seqset.len_seq(i) - width + 1;
+// The starts a window shares with the one before it in the same sequence
+// are counted there, so that the total is the same as for whole sequences
+long Motif::total_positions() const {
+	long ret = 0;
+	for(int i = 0; i < num_seqs; i++) {
+		int from = seqset.first_new_start(i, width) + (seqset.parent_pos(i, 0) > 0);
+		ret += seqset.len_seq(i) - width + 1 - from - seqset.masked_starts(i, width, from);
+	}
 	return ret;
 }
 
-int Motif::positions_in_search_space() const {
-	int ret = 0;
-	for(int i = 0; i < num_seqs; i++)
-		if(possible[i])
-			ret += seqset.len_seq(i) - width + 1;
+long Motif::positions_in_search_space() const {
+	long ret = 0;
+	for(int i = 0; i < num_seqs; i++) {
+		if(! possible[i]) continue;
+		int from = seqset.first_new_start(i, width) + (seqset.parent_pos(i, 0) > 0);
+		ret += seqset.len_seq(i) - width + 1 - from - seqset.masked_starts(i, width, from);
+	}
 	return ret;
 }
 
@@ -434,7 +413,6 @@ void Motif::calc_freq_matrix(float* fm) const {
 }
 
 void Motif::calc_freq_matrix(float* fm, const vector<float>& w) const {
-	const vector<vector <char> >& seq = seqset.seq();
 	for(int i = 0; i < 4 * ncols(); i++) {
 		fm[i] = 0.0;
 	}
@@ -457,7 +435,7 @@ void Motif::calc_freq_matrix(float* fm, const vector<float>& w) const {
 				pos = j + *ci;
 				assert(pos >= 0);
 				assert(pos < len);
-				fm[matpos + seq[g][pos]] += w[g];
+				fm[matpos + seqset.base(g, pos)] += w[g];
 				matpos += 4;
 			}
 		} else {														 // reverse strand
@@ -469,7 +447,7 @@ void Motif::calc_freq_matrix(float* fm, const vector<float>& w) const {
 				pos = j + width - 1 - *ci;
 				assert(pos >= 0);
 				assert(pos < len);
-				fm[matpos + 3 - seq[g][pos]] += w[g];
+				fm[matpos + 3 - seqset.base(g, pos)] += w[g];
 				matpos += 4;
 			}
 		}
@@ -477,7 +455,6 @@ void Motif::calc_freq_matrix(float* fm, const vector<float>& w) const {
 }
 
 void Motif::freq_matrix_extended(vector<float>& fm) const {
-	const vector<vector <char> >& seq = seqset.seq();
 	int i, col, j;
 	int fm_size = fm.size();
 	for(i = 0; i < fm_size; i++) fm[i] = 0.0;
@@ -489,8 +466,8 @@ void Motif::freq_matrix_extended(vector<float>& fm) const {
 		for(j = 0, col = -ncols(); col < width + ncols(); col++, j += 4) {
 			if(s) {
 				if((p + col <= seqset.len_seq(c) - 1) && (p + col >= 0)) {
-					assert(j + seq[c][p + col] < fm_size);
-					fm[j + seq[c][p + col]] += 1.0;
+					assert(j + seqset.base(c, p + col) < fm_size);
+					fm[j + seqset.base(c, p + col)] += 1.0;
 				} else {
 					for(int k = 0; k < 4; k++) {
 						fm[j + k] += 0.25;
@@ -498,8 +475,8 @@ void Motif::freq_matrix_extended(vector<float>& fm) const {
 				}
 			} else {
 				if((p + width - 1 - col <= seqset.len_seq(c) - 1) && (p + width - 1 - col >= 0)) {
-					assert(j + 3 - seq[c][p + width - 1 - col] < fm_size);
-					fm[j + 3 - seq[c][p + width - 1 - col]] += 1.0;
+					assert(j + 3 - seqset.base(c, p + width - 1 - col) < fm_size);
+					fm[j + 3 - seqset.base(c, p + width - 1 - col)] += 1.0;
 				} else {
 					for(int k = 0; k < 4; k++) {
 						fm[j + k] += 0.25;
@@ -535,7 +512,6 @@ string Motif::consensus() const {
 	int numsites = number();
 	if(numsites < 1) return "";
 	char nt[] = {'A', 'C', 'G', 'T'};
-	const vector<vector <char> >& seq = seqset.seq();
 	vector<string> hits;
 	hits.reserve(numsites);
 	vector<Site>::const_iterator si = sitelist.begin();
@@ -549,12 +525,12 @@ string Motif::consensus() const {
 		if(s) {
 			string hitseq = "";
 			for(int k = p; k < p + width; k++)
-				hitseq.append(1, nt[(int) seq[c][k]]);
+				hitseq.append(1, nt[(int) seqset.base(c, k)]);
 			hits.push_back(hitseq);
 		} else {
 			string hitseq = "";
 			for(int k = p + width - 1; k > p - 1; k--)
-				hitseq.append(1, nt[3 - (int) seq[c][k]]);
+				hitseq.append(1, nt[3 - (int) seqset.base(c, k)]);
 			hits.push_back(hitseq);
 		}
 	}
@@ -588,7 +564,6 @@ string Motif::consensus() const {
 
 void Motif::write(ostream& motout) const {
 	char nt[] = {'A', 'C', 'G', 'T'};
-	const vector<vector <char> >& seq = seqset.seq();
 	vector<Site>::const_iterator si = sitelist.begin();
 	vector<Site>::const_iterator se = sitelist.end();
 	for(; si != se; ++si) {
@@ -598,16 +573,16 @@ void Motif::write(ostream& motout) const {
 		for(int j = 0; j < width; j++){
 			if(s) {
 				if(p + j >= 0 && p + j < seqset.len_seq(c))
-					motout << nt[(int) (seq[c][p + j])];
+					motout << nt[(int) (seqset.base(c, p + j))];
 				else motout << ' ';
 			}
 			else {
 				if(p + width - 1 - j >= 0 && p + width - 1 - j < seqset.len_seq(c))
-					motout << nt[3 - (int) seq[c][p + width - 1 - j]];
+					motout << nt[3 - (int) seqset.base(c, p + width - 1 - j)];
 				else motout << ' ';
 			}
 		}
-		motout << '\t' << c << '\t' << p << '\t' << s << '\n';
+		motout << '\t' << seqset.parent(c) << '\t' << seqset.parent_pos(c, p) << '\t' << s << '\n';
 	}
 	int col = 0, prev_col = 0;
 	vector<int>::const_iterator ci = columns.begin();
@@ -633,7 +608,7 @@ void Motif::read(istream& motin) {
 	char* match;
 	char line[200];
 	vector<int> c;
-	vector<int> p;
+	vector<long> p;
 	vector<bool> s;
 	
 	// Read sites
@@ -642,7 +617,7 @@ void Motif::read(istream& motin) {
 		if(line[0] == '*') break;
 		match = strtok(line, "\t");
 		c.push_back(atoi(strtok(NULL, "\t")));
-		p.push_back(atoi(strtok(NULL, "\t")));
+		p.push_back(atol(strtok(NULL, "\t")));
 		s.push_back(atoi(strtok(NULL, "\0")));
 	}
 	
@@ -652,13 +627,17 @@ void Motif::read(istream& motin) {
 		if(line[i] == '*') add_col(i);
 	}
 	
-	// Add sites
+	// Add sites, which are written by position in the sequences before any
+	// split into windows
 	sitelist.clear();
 	int num_sites = c.size();
+	int wc, wp;
 	for(int i = 0; i < num_sites; i++) {
-		assert(p[i] >= 0);
-		assert(p[i] + width - 1 < seqset.len_seq(c[i]));
-		add_site(c[i], p[i], s[i]);
+		if(! seqset.find_window(c[i], p[i], width, wc, wp)) {
+			cerr << "Site " << c[i] << ", " << p[i] << " is not in the sequences, skipping it\n";
+			continue;
+		}
+		add_site(wc, wp, s[i]);
 	}
 	
 	char* heading;
@@ -81,7 +81,6 @@ public:
 	void freq_matrix_extended(vector<float>& fm) const;
 	void calc_score_matrix(double* sm) const;
 	void calc_score_matrix(double* sm, const vector<float>& w) const;
-	double score_site(double* score_matrix, const int c, const int p, const bool s) const;
 	double compare(const Motif& other, const BGModel& bgm);
 	int column(const int i) const { return columns[i]; };
 	vector<int>::const_iterator first_column() const { return columns.begin(); };
@@ -93,8 +92,8 @@ public:
 	bool column_sample(const bool add = 1, const bool remove = 1);
 	void flip_sites();
 	void orient();
-	int total_positions() const;
-	int positions_in_search_space() const;
+	long total_positions() const;
+	long positions_in_search_space() const;
 	void columns_open(int &l, int &r);
 	string consensus() const;                                                // Return the consensus sequence for the current set of sites
 	void read(istream& motin);                                               // Read list of sites from a stream
@@ -41,7 +41,8 @@ float MotifCompare::compare(const Motif& m1, const Motif& m2) const {
 	
 	double bestc = -1.1;
 	double c = 0.0;
-	for(int i = 0; i < fmsize2; i++) {
+	// Only slide the columns as far as they stay within fm2
+	for(int i = 0; i + chosencols1.back() < fmsize2; i++) {
 		vector<int> chosencols2;
 		coliter = chosencols1.begin();
 		for(; coliter != chosencols1.end(); ++coliter)
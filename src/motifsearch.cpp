@@ -1,22 +1,26 @@
+#include <pthread.h>
 #include "motifsearch.h"
 
 MotifSearch::MotifSearch(const vector<string>& names,
-		const vector<string>& seqs,
+		const Seqset& s,
+		const BGModel& bgm,
 		const int nc,
-		const int order,
 		const double sim_cut,
 		const int maxm) :
 nameset(names),
 ngenes(names.size()),
-seqset(seqs),
-bgmodel(seqset, order),
+seqset(s),
+bgmodel(bgm),
 motif(seqset, nc, params.pseudo, params.backfreq),
 select_sites(seqset, nc, params.pseudo, params.backfreq),
 archive(seqset, sim_cut, maxm, params.pseudo, params.backfreq),
 seqscores(ngenes),
 seqranks(ngenes),
 bestpos(ngenes),
-beststrand(ngenes){
+beststrand(ngenes),
+ranked(HUGE_VAL),
+scanner(s, bgm),
+passes(0) {
 	set_default_params();
 }
 
@@ -33,6 +37,7 @@ void MotifSearch::set_default_params(){
 	params.oversample = 1;
 	params.minsize = 5;
 	params.mincorr = 0.4;
+	params.passthreads = 0;
 }
 
 void MotifSearch::set_final_params(){
@@ -61,11 +66,11 @@ void MotifSearch::ace_initialize(){
 	ran_dbl.set_range(0.0, 1.0);
 }
 
-int MotifSearch::total_positions() const {
+long MotifSearch::total_positions() const {
 	return motif.total_positions();
 }
 
-int MotifSearch::positions_in_search_space() const {
+long MotifSearch::positions_in_search_space() const {
 	return motif.positions_in_search_space();
 }
 
@@ -98,6 +103,7 @@ void MotifSearch::genes(int* genes) const {
 
 void MotifSearch::update_seq_count() {
 	int seqn = 0, isect = 0;
+	rank_seqs(motif.get_seq_cutoff());
 	vector<struct idscore>::iterator ids = seqranks.begin();
 	for(; ids != seqranks.end() && ids->score >= motif.get_seq_cutoff(); ++ids) {
 		seqn++;
@@ -137,6 +143,8 @@ void MotifSearch::seed_random_site() {
 		chosen_posit = ran_int.rnum();
 		if(watson && (chosen_posit > seqset.len_seq(chosen_seq) - width - 1)) continue;
 		if((! watson) && (chosen_posit < width)) continue;
+		if(seqset.is_masked(chosen_seq, chosen_posit, width)) continue;
+		if(chosen_posit < seqset.first_new_start(chosen_seq, width)) continue;
 		if(motif.is_open_site(chosen_seq, chosen_posit)) {
 			cerr << "\t\t\tSeeding with (" << chosen_seq << "," << chosen_posit << "," << watson << ")\n";
 			motif.add_site(chosen_seq, chosen_posit, watson);
@@ -147,14 +155,73 @@ void MotifSearch::seed_random_site() {
 
 void MotifSearch::calc_matrix(double* score_matrix) {
 	motif.calc_score_matrix(score_matrix);
+	bgmodel.fold(score_matrix, motif.ncols());
+	BGModel::column_runs(motif.first_column(), motif.last_column(), col_runs);
+	scanner.set_matrix(score_matrix, motif.first_column(), motif.last_column(), motif.get_width(), col_runs);
 }
 
-double MotifSearch::score_site(double* score_matrix, const int c, const int p, const bool s) {
-	double ms = motif.score_site(score_matrix, c, p, s);
-	double bs = bgmodel.score_site(motif.first_column(), motif.last_column(), motif.get_width(), c, p, s);
-	return fastexp(ms - bs);
+// F = Pw + Pc - Pw * Pc is at most 1 - (1 - P)^2 for the larger of Pw and
+// Pc, so a window with both ratios below the one giving that P, less a
+// little for rounding, has F below F.
+double MotifSearch::least_ratio(const double ap, const double F) const {
+	double p = (1.0 - sqrt(1.0 - F)) * (1 - 1e-6);
+	return p * (1.0 - ap) / (ap * (1.0 - p));
 }
 
+struct MotifSearch::PassJob {
+	MotifSearch* search;
+	void (MotifSearch::*scan)(PassJob& job); // scan_sequences() or best_sites()
+	Scanner* scanner;                        // a copy for each thread but the first
+	int first;                               // sequences first to last - 1
+	int last;
+	double ap;
+	double Lmin;
+	bool greedy;
+	bool streams;                            // draw from a stream per sequence rather than from ran_dbl
+	vector<Site> sites;                      // sites to add to motif and select_sites, in sequence order
+	vector<Site> selected;
+};
+
+void* MotifSearch::pass_thread(void* arg) {
+	PassJob* job = (PassJob*) arg;
+	(job->search->*job->scan)(*job);
+	return NULL;
+}
+
+// Sequences are split into runs of about equal length, one run per job, and
+// every job but the first runs on its own thread with its own scanner
+void MotifSearch::run_jobs(vector<PassJob>& jobs, const bool all) {
+	int nthreads = jobs.size();
+	long total = 0, done = 0;
+	for(int g = 0; g < seqset.num_seqs(); g++)
+		if(all || motif.in_search_space(g)) total += seqset.len_seq(g);
+	int first = 0;
+	for(int t = 0; t < nthreads; t++) {
+		jobs[t].search = this;
+		jobs[t].scanner = t == 0 ? &scanner : new Scanner(scanner);
+		jobs[t].first = first;
+		long stop = (t + 1) * (total / nthreads);
+		for(; first < seqset.num_seqs() && (t == nthreads - 1 || done < stop); first++)
+			if(all || motif.in_search_space(first)) done += seqset.len_seq(first);
+		jobs[t].last = first;
+	}
+	vector<pthread_t> threads(nthreads);
+	for(int t = 1; t < nthreads; t++)
+		if(pthread_create(&threads[t], NULL, pass_thread, &jobs[t]) != 0) {
+			cerr << "Unable to start scanning thread\n";
+			exit(1);
+		}
+	(this->*jobs[0].scan)(jobs[0]);
+	for(int t = 1; t < nthreads; t++) {
+		pthread_join(threads[t], NULL);
+		delete jobs[t].scanner;
+	}
+}
+
+// The sites found are added in sequence order once all jobs are done. With
+// params.passthreads set, every sequence draws from its own stream, keyed
+// by the seed, the pass and the sequence, so the sites do not depend on the
+// number of threads; otherwise one thread draws from ran_dbl.
 void MotifSearch::single_pass(bool greedy) {
 	double ap = params.weight * motif.get_search_space_size(); 
 	ap += (1 - params.weight) * motif.number();
@@ -163,59 +230,79 @@ void MotifSearch::single_pass(bool greedy) {
 	calc_matrix(score_matrix);
 	motif.remove_all_sites();
 	select_sites.remove_all_sites();
+	passes++;
+
+	// Windows only count once F exceeds the cutoff / 5, so the scanner may
+	// leave those surely below it at 0, and they are skipped
+	vector<PassJob> jobs(max(params.passthreads, 1));
+	for(unsigned int t = 0; t < jobs.size(); t++) {
+		jobs[t].scan = &MotifSearch::scan_sequences;
+		jobs[t].ap = ap;
+		jobs[t].Lmin = least_ratio(ap, motif.get_seq_cutoff() / 5.0);
+		jobs[t].greedy = greedy;
+		jobs[t].streams = params.passthreads > 0;
+	}
+	run_jobs(jobs, false);
+	
+	for(unsigned int t = 0; t < jobs.size(); t++) {
+		vector<Site>::const_iterator si;
+		for(si = jobs[t].sites.begin(); si != jobs[t].sites.end(); ++si)
+			motif.add_site(si->chrom(), si->posit(), si->strand());
+		for(si = jobs[t].selected.begin(); si != jobs[t].selected.end(); ++si)
+			select_sites.add_site(si->chrom(), si->posit(), si->strand());
+	}
+	delete [] score_matrix;
+}
 
-	double Lw, Lc, Pw, Pc, F;
-	int considered = 0;
-	int gadd = -1, jadd = -1;
+void MotifSearch::scan_sequences(PassJob& job) {
+	const double ap = job.ap;
 	int width = motif.get_width();
-	for(int g = 0; g < seqset.num_seqs(); g++){
+	double Lw[Scanner::BLOCK], Lc[Scanner::BLOCK], Pw, Pc, F;
+	int gadd = -1, jadd = -1;
+	int n, end;
+	for(int g = job.first; g < job.last; g++){
 		if (! motif.in_search_space(g)) continue;
-		for(int j = 0; j < seqset.len_seq(g) - width; j++){
-			Lw = score_site(score_matrix, g, j, 1);
-			Lc = score_site(score_matrix, g, j, 0);
-			Pw = Lw * ap/(1.0 - ap + Lw * ap);
-			Pc = Lc * ap/(1.0 - ap + Lc * ap);
-			F = Pw + Pc - Pw * Pc;
-			if(g == gadd && j < jadd + width) continue;
-			if(F > motif.get_seq_cutoff()/5.0) select_sites.add_site(g, j, true);
-			if(F < motif.get_seq_cutoff()) continue;
-			considered++;
-			Pw = F * Pw / (Pw + Pc);
-			Pc = F - Pw;
-			if(greedy) {                   // Always add if above minprob
-				if(Pw > Pc) {
-					assert(j >= 0);
-					assert(j <= seqset.len_seq(g) - width);
-					motif.add_site(g, j, true);
-					gadd = g;
-					jadd = j;
-				} else {
-					assert(j >= 0);
-					assert(j <= seqset.len_seq(g) - width);
-					motif.add_site(g, j, false);
-					gadd = g;
-					jadd = j;
+		StreamRandom stream(params.seed, passes, g);
+		long gstart = seqset.offset(g);
+		int len = seqset.len_seq(g);
+		const pair<long, long>* mi = seqset.mask_begin(g);
+		const pair<long, long>* me = seqset.mask_end(g);
+		// Starts the previous window of a split sequence scans are left to it
+		for(int j = seqset.first_new_start(g, width); j < len - width; ) {
+			// Score up to a block of windows, stopping short of the next masked run
+			end = len - width;
+			if(mi != me && mi->first - gstart - width + 1 < end) {
+				if(mi->first - gstart - width + 1 <= j) {
+					j = max((long) j, min(mi->second - gstart, (long) len));   // jump past the masked run
+					++mi;
+					continue;
 				}
-			} else {                       // Add with probability F
-				double r = ran_dbl.rnum();
-				if(r > F) continue;
-				if (Pw > Pc) {
-					assert(j >= 0);
-					assert(j <= seqset.len_seq(g) - width);
-					motif.add_site(g, j, true);
-					gadd = g;
-					jadd = j;
-				} else {
-					assert(j >= 0);
-					assert(j <= seqset.len_seq(g) - width);
-					motif.add_site(g, j, false);
-					gadd = g;
-					jadd = j;
+				end = mi->first - gstart - width + 1;
+			}
+			n = min(end - j, Scanner::BLOCK);
+			job.scanner->score(gstart + j, n, Lw, Lc, job.Lmin);
+			for(int k = 0; k < n; k++, j++) {
+				if(Lw[k] < job.Lmin && Lc[k] < job.Lmin) continue;
+				Pw = Lw[k] * ap/(1.0 - ap + Lw[k] * ap);
+				Pc = Lc[k] * ap/(1.0 - ap + Lc[k] * ap);
+				F = Pw + Pc - Pw * Pc;
+				if(g == gadd && j < jadd + width) continue;
+				if(F > motif.get_seq_cutoff()/5.0) job.selected.push_back(Site(g, j, true));
+				if(F < motif.get_seq_cutoff()) continue;
+				Pw = F * Pw / (Pw + Pc);
+				Pc = F - Pw;
+				if(! job.greedy) {             // Add with probability F, else always if above minprob
+					double r = job.streams ? stream.rnum() : ran_dbl.rnum();
+					if(r > F) continue;
 				}
+				assert(j >= 0);
+				assert(j <= seqset.len_seq(g) - width);
+				job.sites.push_back(Site(g, j, Pw > Pc));
+				gadd = g;
+				jadd = j;
 			}
 		}
 	}
-	delete [] score_matrix;
 }
 
 void MotifSearch::single_pass_select(bool greedy) {
@@ -226,7 +313,9 @@ void MotifSearch::single_pass_select(bool greedy) {
 	calc_matrix(score_matrix);
 	motif.remove_all_sites();
 
-	double Lw, Lc, Pw, Pc, F;
+	// Sites with both log ratios below least have F below the cutoff
+	double least = fastexp_floor(least_ratio(ap, motif.get_seq_cutoff()));
+	double Xw, Xc, Lw, Lc, Pw, Pc, F;
 	int g, j;
 	int gadd = -1, jadd = -1;
 	int width = motif.get_width();
@@ -236,8 +325,12 @@ void MotifSearch::single_pass_select(bool greedy) {
 		j = select_sites.posit(i);
 		if (! motif.in_search_space(g)) continue;
 		if(j < 0 || j + width > seqset.len_seq(g)) continue;
-		Lw = score_site(score_matrix, g, j, 1);
-		Lc = score_site(score_matrix, g, j, 0);
+		if(seqset.is_masked(g, j, width)) continue;
+		if(j < seqset.first_new_start(g, width)) continue;
+		scanner.log_ratios(seqset.offset(g) + j, 1, &Xw, &Xc);
+		if(Xw < least && Xc < least) continue;
+		Lw = fastexp(Xw);
+		Lc = fastexp(Xc);
 		Pw = Lw * ap/(1.0 - ap + Lw * ap);
 		Pc = Lc * ap/(1.0 - ap + Lc * ap);
 		F = Pw + Pc - Pw * Pc;
@@ -286,31 +379,73 @@ void MotifSearch::compute_seq_scores() {
 	ap /= 2.0 * motif.positions_in_search_space();
 	double* score_matrix = new double[4 * motif.ncols()];
 	calc_matrix(score_matrix);
-	double Lw, Lc, Pw, Pc, F, bestF;
+	vector<PassJob> jobs(max(params.passthreads, 1));
+	for(unsigned int t = 0; t < jobs.size(); t++) {
+		jobs[t].scan = &MotifSearch::best_sites;
+		jobs[t].ap = ap;
+	}
+	run_jobs(jobs, true);
+	delete [] score_matrix;
+	ranked = HUGE_VAL;
+}
+
+void MotifSearch::best_sites(PassJob& job) {
+	const double ap = job.ap;
 	int width = motif.get_width();
-	int len;
-	for(int g = 0; g < ngenes; g++) {
+	// Windows with both log ratios below least cannot beat bestF, so only the
+	// few that can are turned into F
+	double Xw[Scanner::BLOCK], Xc[Scanner::BLOCK], Lw, Lc, Pw, Pc, F, bestF, least;
+	int len, n, end;
+	for(int g = job.first; g < job.last; g++) {
 		bestF = 0.0;
+		least = -HUGE_VAL;
 		bestpos[g] = -1;
 		len = seqset.len_seq(g);
-		for(int j = 0; j < len - width; j++) {
-			Lw = score_site(score_matrix, g, j, 1);
-			Lc = score_site(score_matrix, g, j, 0);
-			Pw = Lw * ap/(1.0 - ap + Lw * ap);
-			Pc = Lc * ap/(1.0 - ap + Lc * ap);
-			F = Pw + Pc - Pw * Pc;
-			if(F > bestF) {
-				bestF = F;
-				bestpos[g] = j;
-				beststrand[g] = Pw > Pc? 1 : 0;
+		long gstart = seqset.offset(g);
+		const pair<long, long>* mi = seqset.mask_begin(g);
+		const pair<long, long>* me = seqset.mask_end(g);
+		for(int j = seqset.first_new_start(g, width); j < len - width; ) {
+			end = len - width;
+			if(mi != me && mi->first - gstart - width + 1 < end) {
+				if(mi->first - gstart - width + 1 <= j) {
+					j = max((long) j, min(mi->second - gstart, (long) len));
+					++mi;
+					continue;
+				}
+				end = mi->first - gstart - width + 1;
+			}
+			n = min(end - j, Scanner::BLOCK);
+			job.scanner->log_ratios(gstart + j, n, Xw, Xc);
+			for(int k = 0; k < n; k++, j++) {
+				if(Xw[k] < least && Xc[k] < least) continue;
+				Lw = fastexp(Xw[k]);
+				Lc = fastexp(Xc[k]);
+				Pw = Lw * ap/(1.0 - ap + Lw * ap);
+				Pc = Lc * ap/(1.0 - ap + Lc * ap);
+				F = Pw + Pc - Pw * Pc;
+				if(F > bestF) {
+					bestF = F;
+					bestpos[g] = j;
+					beststrand[g] = Pw > Pc? 1 : 0;
+					least = fastexp_floor(least_ratio(ap, bestF));
+				}
 			}
 		}
 		seqscores[g] = bestF;
 		seqranks[g].id = g;
 		seqranks[g].score = seqscores[g];
 	}
-	delete [] score_matrix;
-	sort(seqranks.begin(), seqranks.end(), isc);
+}
+
+// Callers only walk seqranks down to some cutoff, so rather than sorting all
+// of it, those at or above the cutoff are moved to the front and sorted
+void MotifSearch::rank_seqs(const double cutoff) {
+	if(cutoff >= ranked) return;
+	vector<struct idscore>::iterator mid = seqranks.begin();
+	for(vector<struct idscore>::iterator ids = seqranks.begin(); ids != seqranks.end(); ++ids)
+		if(ids->score >= cutoff) swap(*ids, *mid++);
+	sort(seqranks.begin(), mid, isc);
+	ranked = cutoff;
 }
 
 void MotifSearch::compute_seq_scores_minimal() {
@@ -324,9 +459,8 @@ void MotifSearch::compute_seq_scores_minimal() {
 	for(int g = 0; g < seqset.num_seqs(); g++) {
 		// Some best positions might have been invalidated by column sampling
 		// We mark these as invalid and don't score them
-		if(bestpos[g] >= 0 && bestpos[g] + width <= seqset.len_seq(g)) {
-			Lw = score_site(score_matrix, g, bestpos[g], 1);
-			Lc = score_site(score_matrix, g, bestpos[g], 0);
+		if(bestpos[g] >= 0 && bestpos[g] + width <= seqset.len_seq(g) && ! seqset.is_masked(g, bestpos[g], width)) {
+			scanner.score(seqset.offset(g) + bestpos[g], 1, &Lw, &Lc);
 			Pw = Lw * ap/(1.0 - ap + Lw * ap);
 			Pc = Lc * ap/(1.0 - ap + Lc * ap);
 			F = Pw + Pc - Pw * Pc;
@@ -339,8 +473,8 @@ void MotifSearch::compute_seq_scores_minimal() {
 		seqranks[g].score = seqscores[g];
 	}
 	delete [] score_matrix;
-	sort(seqranks.begin(), seqranks.end(), isc);
-	if(seqranks[0].score < 0.85)
+	ranked = HUGE_VAL;
+	if(*max_element(seqscores.begin(), seqscores.end()) < 0.85)
 		compute_seq_scores();
 }
 
@@ -412,6 +546,7 @@ void MotifSearch::modify_params(int argc, char *argv[]){
 	GetArg2(argc, argv, "-seed", params.seed);
 	GetArg2(argc, argv, "-undersample", params.undersample);
 	GetArg2(argc, argv, "-oversample", params.oversample);
+	GetArg2(argc, argv, "-passthreads", params.passthreads);
 }
 
 bool MotifSearch::consider_motif(const char* filename) {
@@ -427,8 +562,11 @@ void MotifSearch::full_output(ostream &fout){
 	fout << "Parameter values:\n";
 	output_params(fout);
 	fout << "\nInput sequences:\n";
+	// Sites are numbered by the sequences before any split into windows,
+	// each of which has the name of its sequence
 	for(unsigned int x = 0; x < nameset.size(); x++)
-		fout << "#" << x << '\t' << nameset[x] << endl;
+		if(seqset.parent_pos(x, 0) == 0)
+			fout << "#" << seqset.parent(x) << '\t' << nameset[x] << endl;
 	fout << '\n';
 	archive.write(fout);
 }
@@ -442,9 +580,10 @@ void MotifSearch::set_seq_cutoff(const int phase) {
 	int seqn = 0, isect = 0;
 	double seqcut, best_seqcut = params.minprob[phase];
 	double po, best_po = DBL_MAX;
+	rank_seqs(params.minprob[phase]);
 	vector<struct idscore>::const_iterator sr_iter = seqranks.begin();
 	for(seqcut = 0.999; seqcut >= params.minprob[phase]; seqcut -= 0.001) {
-		while(sr_iter->score >= seqcut) {
+		while(sr_iter != seqranks.end() && sr_iter->score >= seqcut) {
 			seqn++;
 			if(motif.in_search_space(sr_iter->id))
 				isect++;
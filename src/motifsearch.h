@@ -6,6 +6,7 @@
 #include "fastmath.h"
 #include "seqset.h"
 #include "bgmodel.h"
+#include "scanner.h"
 #include "archivesites.h"
 #include "searchparams.h"
 
@@ -29,19 +30,31 @@ protected:
 	
 	/* Sequence model */
 	SearchParams params;
-	Seqset seqset;
-	BGModel bgmodel;
+	const Seqset& seqset;
+	const BGModel& bgmodel;
 	Motif motif;
 	Motif select_sites;
 	ArchiveSites archive;
 	vector<double> seqscores;
 	vector<struct idscore> seqranks;
 	vector<int> bestpos;
-	vector<bool> beststrand;
+	vector<char> beststrand;                 // not vector<bool>, so that threads may set entries side by side
+	double ranked;                           // seqranks is sorted down to this score, the rest after in any order
 	int members;
+	vector<pair<int, int> > col_runs;        // runs of consecutive motif columns, for background scores
+	Scanner scanner;                         // scores windows with the matrix from calc_matrix()
+	long passes;                             // calls to single_pass(), part of the key of each random stream
 	
-	double score_site(double* score_matrix, const int c, const int p, const bool s);
+	struct PassJob;                          // the sequences one thread scans, and what it finds
+	void run_jobs(vector<PassJob>& jobs, const bool all);         // Split all sequences, or those in the search space,
+	                                                              // among the jobs and run each on its own thread
+	void scan_sequences(PassJob& job);                            // single_pass() for the job's sequences
+	void best_sites(PassJob& job);                                // compute_seq_scores() for the job's sequences
+	static void* pass_thread(void* arg);
+	void rank_seqs(const double cutoff);                          // Sort seqranks down to cutoff
 	void set_cutoffs();
+	double least_ratio(const double ap, const double F) const;    // Return a ratio that a window must reach on one strand
+	                                                              // for its F to reach F
 	void set_seq_cutoff(const int phase);
 	virtual void set_search_space_cutoff(const int phase) = 0;
 	
@@ -54,8 +67,8 @@ public:
 	static const int TOO_MANY_SITES = 5;
 	
 	/* General */
-	MotifSearch(const vector<string>& names, const vector<string>& seqs,
-			const int nc, const int order, const double sim_cut, const int maxm);
+	MotifSearch(const vector<string>& names, const Seqset& s, const BGModel& bgm,
+			const int nc, const double sim_cut, const int maxm);
 	virtual ~MotifSearch() {};
 	void modify_params(int argc, char *argv[]);
 	double get_best_motif(int i=0);
@@ -70,8 +83,8 @@ public:
 	/* Manage search space */
 	virtual void reset_search_space() = 0;                        // Set search space back to initial conditions
 	virtual void adjust_search_space() = 0;                       // Set search space according to current cutoffs
-	int total_positions() const;														      // Return total number of possible positions
-	int positions_in_search_space() const;											  // Return number of potential positions
+	long total_positions() const;														      // Return total number of possible positions
+	long positions_in_search_space() const;											  // Return number of potential positions
 	void clear_sites();																			      // Remove all sites currently in model
 	bool is_member(const int gene) const;										      // Return whether the gene is a member
 	int size() const;                                             // Return number of genes
@@ -79,8 +92,9 @@ public:
 	void genes(int* genes) const;                                 // Return the genes that are assigned to this model
 	
 	/* Sequence model*/
-	Seqset& get_seqset() { return seqset; }                       // Return the set of sequences
-	void calc_matrix(double* score_matrix);                       // Calculate the PWM for the current set of sites
+	const Seqset& get_seqset() const { return seqset; }           // Return the set of sequences
+	void calc_matrix(double* score_matrix);                       // Calculate the PWM for the current set of sites, and
+	                                                              // pass it to the scanner
 	virtual double score();                                       // Calculate the score of the current model
 	double matrix_score();                                        // Calculate the entropy score for the current matrix
 	double over_score();                                          // Calculate the overrepresentation score
@@ -1,14 +1,14 @@
 #include "motifsearchexpr.h"
 
 MotifSearchExpr::MotifSearchExpr(const vector<string>& names,
-																 const vector<string>& seqs,
+																 const Seqset& s,
+																 const BGModel& bgm,
 																 const int nc,
-																 const int order,
 																 const double sim_cut,
 																 const int maxm,
 																 vector<vector <float> >& exprtab,
 																 const int npts) :
-MotifSearch(names, seqs, nc, order, sim_cut, maxm),
+MotifSearch(names, s, bgm, nc, sim_cut, maxm),
 expr(exprtab),
 npoints(npts),
 mean(npoints),
@@ -14,8 +14,8 @@ class MotifSearchExpr : public MotifSearch {
 	void compute_expr_scores();                                   // Calculate expression scores for sequences
 	
 public:
-	MotifSearchExpr(const vector<string>& names, const vector<string>& seqs,
-			const int nc, const int order, const double sim_cut, const int maxm,
+	MotifSearchExpr(const vector<string>& names, const Seqset& s, const BGModel& bgm,
+			const int nc, const double sim_cut, const int maxm,
 			vector<vector <float> >& exprtab, const int npts);
 	void set_final_params();
 	void reset_search_space();
@@ -1,13 +1,13 @@
 #include "motifsearchscore.h"
 
 MotifSearchScore::MotifSearchScore(const vector<string>& names,
-																 const vector<string>& seqs,
+																 const Seqset& s,
+																 const BGModel& bgm,
 																 const int nc,
-																 const int order,
 																 const double sim_cut,
 																 const int maxm,
 																 vector<float>& sctab) :
-MotifSearch(names, seqs, nc, order, sim_cut, maxm),
+MotifSearch(names, s, bgm, nc, sim_cut, maxm),
 scores(sctab),
 scranks(ngenes) {
 	for(int i = 0; i < ngenes; i++) {
@@ -69,6 +69,7 @@ void MotifSearchScore::set_search_space_cutoff(const int) {
 
 void MotifSearchScore::calc_matrix(double* score_matrix) {
 	motif.calc_score_matrix(score_matrix, scores);
+	bgmodel.fold(score_matrix, motif.ncols());
 }
 
 int MotifSearchScore::search_for_motif(const int worker, const int iter, const string outfile) {
@@ -11,8 +11,8 @@ class MotifSearchScore : public MotifSearch {
 	vector<struct idscore> scranks;
 
 public:
-	MotifSearchScore(const vector<string>& names, const vector<string>& seqs,
-			const int nc, const int order, const double sim_cut, const int maxm,
+	MotifSearchScore(const vector<string>& names, const Seqset& s, const BGModel& bgm,
+			const int nc, const double sim_cut, const int maxm,
 			vector<float>& sctab);
 	void reset_search_space();
 	void adjust_search_space();
@@ -1,13 +1,13 @@
 #include "motifsearchsubset.h"
 
 MotifSearchSubset::MotifSearchSubset(const vector<string>& names,
-																 const vector<string>& seqs,
+																 const Seqset& s,
+																 const BGModel& bgm,
 																 const int nc,
-																 const int order,
 																 const double sim_cut,
 																 const int maxm,
 																 const vector<string>& sub) :
-MotifSearch(names, seqs, nc, order, sim_cut, maxm),
+MotifSearch(names, s, bgm, nc, sim_cut, maxm),
 subset(sub) {
 	reset_search_space();
 }
@@ -7,8 +7,8 @@ class MotifSearchSubset : public MotifSearch {
 	const vector<string>& subset;
 	
 public:
-	MotifSearchSubset(const vector<string>& names, const vector<string>& seqs,
-									const int nc, const int order, const double sim_cut, const int maxm,
+	MotifSearchSubset(const vector<string>& names, const Seqset& s, const BGModel& bgm,
+									const int nc, const double sim_cut, const int maxm,
 									const vector<string>& sub);
 	void set_final_params();
 	void reset_search_space();
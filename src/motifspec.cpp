@@ -3,6 +3,13 @@
 int main(int argc, char *argv[]) {
 	set_new_handler(alloc_error);
 
+	string shmremove;                     // shared memory to clean up instead of searching
+	if(GetArg2(argc, argv, "-shmremove", shmremove)) {
+		if(shmremove[0] != '/') shmremove = "/" + shmremove;
+		if(SeqCache::remove_shared(shmremove) == 0) cerr << "No shared memory made with -shm " << shmremove << "\n";
+		exit(0);
+	}
+
 	if(argc < 6) {
 		print_usage(cout);
 		exit(0);
@@ -48,10 +55,133 @@ int main(int argc, char *argv[]) {
 	}
 	
 	// Read parameters
-	vector<string> seqs;
-	cerr << "Reading sequence data from '" << seqfile << "'... ";
-	get_fasta_fast(seqfile.c_str(), seqs, seq_nameset);
-	cerr << "done.\n";
+	if(! GetArg2(argc, argv, "-order", order)) order = 0;
+	int nthreads;                         // threads used to decompress BGZF input and train the background
+	if(! GetArg2(argc, argv, "-threads", nthreads)) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool lean = GetArg2(argc, argv, "-lean");           // score the background while scanning instead of storing it
+	string reffile;                       // indexed genome, when seqfile lists positions
+	bool use_ref = GetArg2(argc, argv, "-ref", reffile);
+	const char* refname = use_ref ? reffile.c_str() : NULL;
+	string cachefile;                     // file with preprocessed sequences and background
+	bool use_cache = GetArg2(argc, argv, "-cache", cachefile);
+	string shmname;                       // shared memory object with the same, for all workers on a host
+	bool use_shm = GetArg2(argc, argv, "-shm", shmname);
+	if(use_shm && shmname[0] != '/') shmname = "/" + shmname;
+	string bgin, bgseq, bgout;            // saved background tables to use, corpus to train them on, file to save them to
+	bool use_bgin = GetArg2(argc, argv, "-bgin", bgin);
+	bool use_bgseq = GetArg2(argc, argv, "-bgseq", bgseq);
+	bool use_bgout = GetArg2(argc, argv, "-bgout", bgout);
+	string bgtables;                      // tables trained on other sequences, if any
+	long bgstamp = 0;
+	if(use_bgin) {
+		cerr << "Loading background model from '" << bgin << "'... ";
+		if(! BGModel::read_file(bgin.c_str(), bgtables)) {
+			cerr << "\nInvalid background model file '" << bgin << "'\n";
+			exit(1);
+		}
+		order = BGModel::tables_order(bgtables);
+		cerr << "done.\n";
+	} else if(use_bgseq) {
+		cerr << "Training background model on '" << bgseq << "'... ";
+		bgtables = BGModel::train_file(bgseq.c_str(), order, nthreads);
+		cerr << "done.\n";
+	}
+	if(! bgtables.empty()) bgstamp = SeqCache::table_stamp(bgtables);
+	if(use_shm) shmname = SeqCache::shared_name(shmname, seqfile.c_str(), refname, order, bgstamp);
+	bool shm_owner = false;
+	SeqCache cache;
+	Seqset* seqset;
+	BGModel* bgmodel;
+	if(use_shm && cache.open_shared(shmname.c_str(), seqfile.c_str(), refname, order, shm_owner, bgstamp)) {
+		cerr << "Attaching to shared sequence data in '" << shmname << "'... ";
+		seqset = cache.seqset();
+		cache.names(seq_nameset);
+		bgmodel = cache.bgmodel(*seqset, lean);
+		cerr << "done.\n";
+	} else if(use_cache && cache.open(cachefile.c_str(), seqfile.c_str(), refname, order, bgstamp)) {
+		cerr << "Mapping preprocessed sequence data from '" << cachefile << "'... ";
+		seqset = cache.seqset();
+		cache.names(seq_nameset);
+		bgmodel = cache.bgmodel(*seqset, lean);
+		cerr << "done.\n";
+	} else {
+		seqset = new Seqset();
+		if(use_ref) {
+			cerr << "Extracting positions in '" << seqfile << "' from '" << reffile << "'... ";
+			read_positions(seqfile.c_str(), reffile.c_str(), *seqset, seq_nameset);
+		} else {
+			cerr << "Reading sequence data from '" << seqfile << "'... ";
+			read_fasta(seqfile.c_str(), *seqset, seq_nameset, nthreads);
+		}
+		cerr << "done.\n";
+		if(bgtables.empty()) {
+			cerr << "Training background model... ";
+			bgmodel = new BGModel(*seqset, order, nthreads, lean);
+		} else {
+			cerr << "Scoring with background model... ";
+			istringstream tables(bgtables);
+			bgmodel = new BGModel(*seqset, tables, lean);
+		}
+		cerr << "done.\n";
+		if(use_cache) {
+			cerr << "Writing preprocessed sequence data to '" << cachefile << "'... ";
+			if(SeqCache::write(cachefile.c_str(), seqfile.c_str(), refname, *seqset, seq_nameset, *bgmodel, bgstamp))
+				cerr << "done.\n";
+			else
+				cerr << "failed!\n";
+		}
+	}
+	if(shm_owner) {
+		cerr << "Writing shared sequence data to '" << shmname << "'... ";
+		if(cache.write_shared(shmname.c_str(), seqfile.c_str(), refname, *seqset, seq_nameset, *bgmodel, bgstamp))
+			cerr << "done.\n";
+		else
+			cerr << "failed!\n";
+	}
+	if(use_bgout) {
+		cerr << "Writing background model to '" << bgout << "'... ";
+		if(bgmodel->write_file(bgout.c_str()))
+			cerr << "done.\n";
+		else
+			cerr << "failed!\n";
+	}
+	if(! GetArg2(argc, argv, "-numcols", ncol)) ncol = 10;
+	int window, overlap;                  // long sequences are searched in overlapping windows
+	if(! GetArg2(argc, argv, "-window", window)) window = 1000000;
+	if(! GetArg2(argc, argv, "-overlap", overlap)) overlap = 1000;
+	if(overlap >= window) {
+		cerr << "Window overlap must be less than the window size\n\n";
+		print_usage(cout);
+		exit(0);
+	}
+	if(overlap < 3 * ncol) {
+		// A motif grows to at most 3 * ncol bases (Motif::max_width), and a site
+		// no window holds whole would never be found
+		cerr << "Window overlap must be at least the widest motif, " << 3 * ncol << " bases\n\n";
+		print_usage(cout);
+		exit(0);
+	}
+	Seqset* fullset = seqset;
+	if(seqset->max_len() > window) {
+		seqset = new Seqset(*fullset, window, overlap);
+		vector<string> window_names;
+		for(int i = 0; i < seqset->num_seqs(); i++)
+			window_names.push_back(seq_nameset[seqset->parent(i)]);
+		swap(seq_nameset, window_names);
+		cerr << "Split " << fullset->num_seqs() << " sequences into " << seqset->num_seqs() << " windows\n";
+		// Each window takes its sequence's name, data and subset membership, so
+		// the set statistics weigh a sequence by its number of windows
+		cerr << "Sequence counts and specificity scores count windows, not sequences\n";
+	}
+	string masktype;                      // bases to skip when scanning
+	if(GetArg2(argc, argv, "-mask", masktype)) {
+		if(masktype != "n" && masktype != "soft") {
+			cerr << "Mask must be 'n' or 'soft'\n\n";
+			print_usage(cout);
+			exit(0);
+		}
+		seqset->set_mask(masktype == "soft");
+	}
 	ngenes = seq_nameset.size();
 	
 	npoints = 0;
@@ -98,17 +228,15 @@ int main(int argc, char *argv[]) {
 	}
 
 	cerr << "Setting up MotifSearch... ";
-	if(! GetArg2(argc, argv, "-numcols", ncol)) ncol = 10;
-	if(! GetArg2(argc, argv, "-order", order)) order = 0;
 	if(! GetArg2(argc, argv, "-simcut", simcut)) simcut = 0.8;
 	if(! GetArg2(argc, argv, "-maxm", maxm)) maxm = 20;
 	MotifSearch* ms;
 	if(search_type == EXPRESSION) {
-		ms = new MotifSearchExpr(seq_nameset, seqs, ncol, order, simcut, maxm, newexpr, npoints);
+		ms = new MotifSearchExpr(seq_nameset, *seqset, *bgmodel, ncol, simcut, maxm, newexpr, npoints);
 	} else if(search_type == SCORE) {
-		ms = new MotifSearchScore(seq_nameset, seqs, ncol, order, simcut, maxm, newscores);
+		ms = new MotifSearchScore(seq_nameset, *seqset, *bgmodel, ncol, simcut, maxm, newscores);
 	} else {
-		ms = new MotifSearchSubset(seq_nameset, seqs, ncol, order, simcut, maxm, subset);
+		ms = new MotifSearchSubset(seq_nameset, *seqset, *bgmodel, ncol, simcut, maxm, subset);
 	}
 	ms->modify_params(argc, argv);
 	ms->set_final_params();
@@ -133,7 +261,7 @@ int main(int argc, char *argv[]) {
 		}
 	} else {
 		cerr << "Running as worker " << worker << "...\n";
-		int nruns = ms->positions_in_search_space()/(ms->get_params().expect * ncol);
+		long nruns = ms->positions_in_search_space()/(ms->get_params().expect * ncol);
 		nruns *= ms->get_params().oversample;
 		nruns /= ms->get_params().undersample;
 		cerr << "Restarts planned: " << nruns << '\n';
@@ -141,7 +269,7 @@ int main(int argc, char *argv[]) {
 		archinstr.append(".ms");
 		string lockstr(outfile);
 		lockstr.append(".lock");
-		for(int j = 1; j <= nruns; j++) {
+		for(long j = 1; j <= nruns; j++) {
 			if(j == 1 || j % 50 == 0 || search_type == SUBSET) {
 				struct flock fl;
 				int fd;
@@ -178,6 +306,9 @@ int main(int argc, char *argv[]) {
 		}
 	}
 	delete ms;
+	delete bgmodel;
+	if(seqset != fullset) delete seqset;
+	delete fullset;
 	return 0;
 }
 
@@ -286,13 +417,27 @@ void output(MotifSearch* ms) {
 
 void print_usage(ostream& fout) {
 	fout << "Usage: motifspec -s seqfile [-ex exprfile | -su subsetfile | -sc scorefile] -o outputfile (options)\n";
-	fout << " Seqfile must be in FASTA format.\n";
+	fout << " Seqfile must be in FASTA format, optionally compressed with gzip or bgzip.\n";
 	fout << " Exprfile must be in tab-delimited format.\n";
 	fout << " Subsetfile has one sequence name per line.\n";
 	fout << " Scorefile is tab-delimited, with one sequence name and score per line.";
 	fout << "Options:\n";
 	fout << " -numcols    \tnumber of columns to align (10)\n";
-	fout << " -order      \torder of the background model (3, can be 0 to 5)\n";
+	fout << " -order      \torder of the background model (3, can be 0 to 10)\n";
+	fout << " -bgin       \tbackground model file saved by -bgout, used instead of training (sets -order)\n";
+	fout << " -bgseq      \tFASTA file to train the background model on, instead of seqfile; may be genome-sized\n";
+	fout << " -bgout      \tfile to save the background model to, for -bgin\n";
+	fout << " -ref        \tindexed genome FASTA (with .fai); seqfile then lists positions as chr:start-end\n";
+	fout << " -cache      \tfile of preprocessed sequences, written if missing or out of date\n";
+	fout << " -shm        \tname of shared memory holding preprocessed sequences and scores for all workers; it is\n";
+	fout << "             \tkept for later runs, one object per order and input, until removed or the host reboots\n";
+	fout << " -shmremove  \tremove the shared memory made with -shm under this name, for any input, and exit\n";
+	fout << " -threads    \tnumber of threads for reading bgzip compressed input and training the background (all processors)\n";
+	fout << " -window     \tsearch sequences longer than this in overlapping windows (1000000); sequence counts and\n";
+	fout << "             \tspecificity scores then count windows, so a sequence split in n counts n times\n";
+	fout << " -overlap    \toverlap between windows, at least the widest motif of 3 x numcols bases (1000)\n";
+	fout << " -lean       \tcompute background scores while scanning instead of storing them (saves 24 bytes per base)\n";
+	fout << " -mask       \tskip non-ACGT bases (n) or these and lowercase bases (soft) when scanning (none)\n";
 	fout << " -simcut     \tsimilarity cutoff for motifs (0.8)\n"; 
 	fout << " -maxm       \tmaximum number of motifs to output (20)\n";
 	fout << " -expect     \tnumber of sites expected in model (10)\n";
@@ -300,4 +445,6 @@ void print_usage(ostream& fout) {
 	fout << " -seed       \tset seed for random number generator (time)\n";
 	fout << " -undersample\tpossible sites / (expect * numcols * seedings) (1)\n"; 
 	fout << " -oversample\t1/undersample (1)\n";
+	fout << " -passthreads\tthreads for each pass over the sequences; any number gives the same results for a seed,\n";
+	fout << "             \tbut not those of the default single thread (0)\n";
 }
@@ -4,6 +4,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include "standard.h"
+#include "seqcache.h"
+#include "fasta.h"
+#include "faidx.h"
 #include "motifsearch.h"
 #include "motifsearchexpr.h"
 #include "motifsearchscore.h"
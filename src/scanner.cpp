@@ -0,0 +1,480 @@
+#include <string.h>
+#include <immintrin.h>
+#include "scanner.h"
+#include "fastmath.h"
+
+// Every lane adds up its window's columns in the same order as the scalar
+// code, and fastexp() is done with the same double arithmetic and
+// truncation, so the ratios are the same whichever kernel runs.
+
+const int Scanner::BLOCK;
+
+template<int N> void Scanner::set_kernels() {
+	unrolled_sums[0][N] = &Scanner::sum_cols<N, false>;
+	unrolled_sums[1][N] = &Scanner::sum_cols<N, true>;
+	unrolled_quantized[0][N] = &Scanner::quantized_cols<N, false>;
+	unrolled_quantized[1][N] = &Scanner::quantized_cols<N, true>;
+	unrolled_window[0][N] = &Scanner::window_cols<N, false>;
+	unrolled_window[1][N] = &Scanner::window_cols<N, true>;
+	set_kernels<N - 1>();
+}
+
+template<> void Scanner::set_kernels<0>() {
+}
+
+Scanner::Scanner(const Seqset& s, const BGModel& bgm) :
+seqset(s),
+bgmodel(bgm),
+width(0),
+ncols(0),
+qscale(1),
+qerror(0),
+wsum(BLOCK + 4),
+csum(BLOCK + 4),
+wqsum(BLOCK + 16),
+cqsum(BLOCK + 16),
+wbg(BLOCK + 4, 0.0),
+cbg(BLOCK + 4, 0.0),
+passed(BLOCK) {
+	__builtin_cpu_init();
+	avx2 = __builtin_cpu_supports("avx2");
+	if(avx2) {
+		generic_sums = &Scanner::sum_avx2;
+		generic_quantized = &Scanner::quantized_avx2;
+		screen = &Scanner::screen_avx2;
+		sum_background = &Scanner::background_avx2;
+		find_ratios = &Scanner::ratios_avx2;
+	} else if(__builtin_cpu_supports("sse4.1")) {
+		generic_sums = &Scanner::sum_sse4;
+		generic_quantized = &Scanner::quantized_sse4;
+		screen = &Scanner::screen_scalar;
+		sum_background = &Scanner::background_scalar;
+		find_ratios = &Scanner::ratios_scalar;
+	} else {
+		generic_sums = &Scanner::sum_scalar;
+		generic_quantized = NULL;
+		screen = &Scanner::screen_scalar;
+		sum_background = &Scanner::background_scalar;
+		find_ratios = &Scanner::ratios_scalar;
+	}
+	sum_columns = generic_sums;
+	sum_quantized = generic_quantized;
+	sum_window = &Scanner::window_generic;
+	set_kernels<MAX_UNROLLED>();
+}
+
+// The quantized matrix is scaled so that the largest entries of all the
+// columns add up to 32000, which leaves room for the rounding of each.
+void Scanner::set_matrix(const double* sm, vector<int>::const_iterator first_col, vector<int>::const_iterator last_col,
+		const int w, const vector<pair<int, int> >& col_runs) {
+	width = w;
+	cols.assign(first_col, last_col);
+	ncols = cols.size();
+	runs = col_runs;
+	wrows.assign(sm, sm + 4 * ncols);
+	crows.resize(4 * ncols);
+	for(int k = 0; k < 4 * ncols; k += 4)
+		for(int b = 0; b < 4; b++)
+			crows[k + b] = sm[k + 3 - b];
+	
+	double maxsum = 0;
+	for(int k = 0; k < 4 * ncols; k += 4)
+		maxsum += max(max(fabs(sm[k]), fabs(sm[k + 1])), max(fabs(sm[k + 2]), fabs(sm[k + 3])));
+	qscale = maxsum > 0 ? 32000 / maxsum : 1;
+	qerror = (0.5 * ncols + 1) / qscale;                         // with a little over for rounding in the double sums
+	wqrows.resize(8 * ncols);
+	cqrows.resize(8 * ncols);
+	for(int k = 0; k < ncols; k++) {
+		for(int b = 0; b < 4; b++) {
+			wqrows[8 * k + b] = wqrows[8 * k + 4 + b] = (int16_t) lround(wrows[4 * k + b] * qscale);
+			cqrows[8 * k + b] = cqrows[8 * k + 4 + b] = (int16_t) lround(crows[4 * k + b] * qscale);
+		}
+	}
+	
+	// The columns of a gapless motif are 0 to width - 1
+	const bool gapless = ncols == width;
+	const bool unrolled = ncols <= MAX_UNROLLED;
+	sum_columns = avx2 && unrolled ? unrolled_sums[gapless][ncols] : generic_sums;
+	sum_quantized = avx2 && unrolled ? unrolled_quantized[gapless][ncols] : generic_quantized;
+	sum_window = unrolled ? unrolled_window[gapless][ncols] : &Scanner::window_generic;
+	
+	// Room for the vector kernels to read a few codes past the last window
+	codes.resize(BLOCK + width + 32);
+	shuffles.resize(BLOCK + width + 32);
+}
+
+// A lone window is summed a byte at a time: the block kernels would load
+// the codes just stored by unpack() before the stores could be forwarded.
+void Scanner::score(const long gp, const int n, double* Lw, double* Lc) {
+	unpack(gp, n + width - 1);
+	if(n == 1) {
+		(this->*sum_window)(0);
+		background_scalar(gp, 1);
+		ratios_scalar(1, Lw, Lc);
+		return;
+	}
+	(this->*sum_columns)(n);
+	(this->*sum_background)(gp, n);
+	(this->*find_ratios)(n, Lw, Lc);
+}
+
+void Scanner::log_ratios(const long gp, const int n, double* Xw, double* Xc) {
+	unpack(gp, n + width - 1);
+	if(n == 1) {
+		(this->*sum_window)(0);
+		background_scalar(gp, 1);
+	} else {
+		(this->*sum_columns)(n);
+		(this->*sum_background)(gp, n);
+	}
+	for(int i = 0; i < n; i++) {
+		Xw[i] = wsum[i] - wbg[i];
+		Xc[i] = csum[i] - cbg[i];
+	}
+}
+
+// Windows are screened with the quantized sums, and only those whose log
+// ratios might reach fastexp_floor(Lmin) are summed exactly. Lean
+// backgrounds are too slow to score every window for this, so they are
+// scored as usual.
+void Scanner::score(const long gp, const int n, double* Lw, double* Lc, const double Lmin) {
+	if(sum_quantized == NULL || Lmin <= 0 || (! bgmodel.folded() && ! bgmodel.has_scores())) {
+		score(gp, n, Lw, Lc);
+		return;
+	}
+	const double cut = fastexp_floor(Lmin);
+	const int m = n + width - 1;
+	unpack(gp, m);
+	for(int i = 0; i < m; i++)
+		shuffles[i] = codes[i] * 0x202 + 0x100;
+	(this->*sum_quantized)(n);
+	(this->*sum_background)(gp, n);
+	const int npassed = (this->*screen)(n, cut);
+	memset(Lw, 0, n * sizeof(double));
+	memset(Lc, 0, n * sizeof(double));
+	for(int p = 0; p < npassed; p++) {
+		const int i = passed[p];
+		(this->*sum_window)(i);
+		Lw[i] = fastexp(wsum[i] - wbg[i]);
+		Lc[i] = fastexp(csum[i] - cbg[i]);
+	}
+}
+
+// Four codes for each byte of packed bases, in memory order
+static struct CodeTable {
+	uint32_t codes[256];
+	CodeTable() {
+		for(int i = 0; i < 256; i++)
+			codes[i] = (i & 3) | ((i >> 2) & 3) << 8 | ((i >> 4) & 3) << 16 | (uint32_t) ((i >> 6) & 3) << 24;
+	}
+} code_table;
+
+// Whole words are unpacked, so up to 31 codes past n are overwritten; the
+// vector kernels only read those in spare lanes.
+void Scanner::unpack(const long gp, const int n) {
+	unsigned char* out = &codes[0];
+	for(int i = 0; i < n; i += 32) {
+		uint64_t w = seqset.word_at(gp + i);
+		for(int b = 0; b < 8; b++, w >>= 8)
+			memcpy(out + i + 4 * b, &code_table.codes[w & 255], 4);
+	}
+}
+
+void Scanner::sum_scalar(const int n) {
+	for(int i = 0; i < n; i++)
+		wsum[i] = csum[i] = 0.0;
+	for(int k = 0; k < ncols; k++) {
+		const double* wr = &wrows[4 * k];
+		const double* cr = &crows[4 * k];
+		const unsigned char* wc = &codes[cols[k]];
+		const unsigned char* cc = &codes[width - 1 - cols[k]];   // the Crick strand of column k, complemented by cr
+		for(int i = 0; i < n; i++) {
+			wsum[i] += wr[wc[i]];
+			csum[i] += cr[cc[i]];
+		}
+	}
+}
+
+void Scanner::window_generic(const int i) {
+	double w = 0.0, c = 0.0;
+	for(int k = 0; k < ncols; k++) {
+		w += wrows[4 * k + codes[i + cols[k]]];
+		c += crows[4 * k + codes[i + width - 1 - cols[k]]];
+	}
+	wsum[i] = w;
+	csum[i] = c;
+}
+
+// Each entry is picked from its row by blending on the two bits of the code
+__attribute__((target("sse4.1")))
+void Scanner::sum_sse4(const int n) {
+	for(int i = 0; i < n; i += 2) {
+		_mm_storeu_pd(&wsum[i], _mm_setzero_pd());
+		_mm_storeu_pd(&csum[i], _mm_setzero_pd());
+	}
+	for(int k = 0; k < ncols; k++) {
+		const double* r[2] = { &wrows[4 * k], &crows[4 * k] };
+		const unsigned char* c[2] = { &codes[cols[k]], &codes[width - 1 - cols[k]] };
+		double* sum[2] = { &wsum[0], &csum[0] };
+		for(int s = 0; s < 2; s++) {
+			const __m128d a = _mm_set1_pd(r[s][0]), b = _mm_set1_pd(r[s][1]);
+			const __m128d g = _mm_set1_pd(r[s][2]), t = _mm_set1_pd(r[s][3]);
+			for(int i = 0; i < n; i += 2) {
+				uint16_t x;
+				memcpy(&x, c[s] + i, 2);
+				__m128i idx = _mm_cvtepu8_epi64(_mm_cvtsi32_si128(x));
+				__m128d low = _mm_castsi128_pd(_mm_slli_epi64(idx, 63));
+				__m128d high = _mm_castsi128_pd(_mm_slli_epi64(idx, 62));
+				__m128d v = _mm_blendv_pd(_mm_blendv_pd(a, b, low), _mm_blendv_pd(g, t, low), high);
+				_mm_storeu_pd(sum[s] + i, _mm_add_pd(_mm_loadu_pd(sum[s] + i), v));
+			}
+		}
+	}
+}
+
+// Each row is held as two halves of two entries; the low bit of the code
+// picks within a half and the high bit picks the half
+__attribute__((target("avx2")))
+static inline __m256d pick_avx2(const double* row, const unsigned char* c) {
+	uint32_t x;
+	memcpy(&x, c, 4);
+	__m256i idx = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(x));
+	__m256i sel = _mm256_slli_epi64(idx, 1);
+	return _mm256_blendv_pd(_mm256_permutevar_pd(_mm256_broadcast_pd((const __m128d*) row), sel),
+			_mm256_permutevar_pd(_mm256_broadcast_pd((const __m128d*) (row + 2)), sel),
+			_mm256_castsi256_pd(_mm256_slli_epi64(idx, 62)));
+}
+
+__attribute__((target("avx2")))
+void Scanner::sum_avx2(const int n) {
+	for(int i = 0; i < n; i += 4) {
+		_mm256_storeu_pd(&wsum[i], _mm256_setzero_pd());
+		_mm256_storeu_pd(&csum[i], _mm256_setzero_pd());
+	}
+	for(int k = 0; k < ncols; k++) {
+		const double* wr = &wrows[4 * k];
+		const double* cr = &crows[4 * k];
+		const unsigned char* wc = &codes[cols[k]];
+		const unsigned char* cc = &codes[width - 1 - cols[k]];
+		for(int i = 0; i < n; i += 4) {
+			_mm256_storeu_pd(&wsum[i], _mm256_add_pd(_mm256_loadu_pd(&wsum[i]), pick_avx2(wr, wc + i)));
+			_mm256_storeu_pd(&csum[i], _mm256_add_pd(_mm256_loadu_pd(&csum[i]), pick_avx2(cr, cc + i)));
+		}
+	}
+}
+
+// The shuffles pick the two bytes of each entry from a row of quantized
+// scores; the saturating adds can never saturate at the chosen scale.
+__attribute__((target("sse4.1")))
+void Scanner::quantized_sse4(const int n) {
+	for(int i = 0; i < n; i += 8) {
+		_mm_storeu_si128((__m128i*) &wqsum[i], _mm_setzero_si128());
+		_mm_storeu_si128((__m128i*) &cqsum[i], _mm_setzero_si128());
+	}
+	for(int k = 0; k < ncols; k++) {
+		const __m128i wt = _mm_loadu_si128((const __m128i*) &wqrows[8 * k]);
+		const __m128i ct = _mm_loadu_si128((const __m128i*) &cqrows[8 * k]);
+		const uint16_t* ws = &shuffles[cols[k]];
+		const uint16_t* cs = &shuffles[width - 1 - cols[k]];
+		for(int i = 0; i < n; i += 8) {
+			__m128i wv = _mm_shuffle_epi8(wt, _mm_loadu_si128((const __m128i*) (ws + i)));
+			__m128i cv = _mm_shuffle_epi8(ct, _mm_loadu_si128((const __m128i*) (cs + i)));
+			_mm_storeu_si128((__m128i*) &wqsum[i], _mm_adds_epi16(_mm_loadu_si128((const __m128i*) &wqsum[i]), wv));
+			_mm_storeu_si128((__m128i*) &cqsum[i], _mm_adds_epi16(_mm_loadu_si128((const __m128i*) &cqsum[i]), cv));
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+void Scanner::quantized_avx2(const int n) {
+	for(int i = 0; i < n; i += 16) {
+		_mm256_storeu_si256((__m256i*) &wqsum[i], _mm256_setzero_si256());
+		_mm256_storeu_si256((__m256i*) &cqsum[i], _mm256_setzero_si256());
+	}
+	for(int k = 0; k < ncols; k++) {
+		const __m256i wt = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &wqrows[8 * k]));
+		const __m256i ct = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &cqrows[8 * k]));
+		const uint16_t* ws = &shuffles[cols[k]];
+		const uint16_t* cs = &shuffles[width - 1 - cols[k]];
+		for(int i = 0; i < n; i += 16) {
+			__m256i wv = _mm256_shuffle_epi8(wt, _mm256_loadu_si256((const __m256i*) (ws + i)));
+			__m256i cv = _mm256_shuffle_epi8(ct, _mm256_loadu_si256((const __m256i*) (cs + i)));
+			_mm256_storeu_si256((__m256i*) &wqsum[i], _mm256_adds_epi16(_mm256_loadu_si256((const __m256i*) &wqsum[i]), wv));
+			_mm256_storeu_si256((__m256i*) &cqsum[i], _mm256_adds_epi16(_mm256_loadu_si256((const __m256i*) &cqsum[i]), cv));
+		}
+	}
+}
+
+// With the number of columns known, the column loop is unrolled inside the
+// loop over windows, and the sums stay in registers. Gapless motifs also
+// have their column offsets fixed at compile time.
+template<int N, bool GAPLESS> __attribute__((target("avx2")))
+void Scanner::sum_cols(const int n) {
+	int woff[N], coff[N];
+	for(int k = 0; k < N; k++) {
+		woff[k] = GAPLESS ? k : cols[k];
+		coff[k] = GAPLESS ? N - 1 - k : width - 1 - cols[k];
+	}
+	const double* wr = &wrows[0];
+	const double* cr = &crows[0];
+	const unsigned char* c = &codes[0];
+	for(int i = 0; i < n; i += 4) {
+		__m256d w = _mm256_setzero_pd(), v = _mm256_setzero_pd();
+#pragma GCC unroll 32
+		for(int k = 0; k < N; k++) {
+			w = _mm256_add_pd(w, pick_avx2(wr + 4 * k, c + woff[k] + i));
+			v = _mm256_add_pd(v, pick_avx2(cr + 4 * k, c + coff[k] + i));
+		}
+		_mm256_storeu_pd(&wsum[i], w);
+		_mm256_storeu_pd(&csum[i], v);
+	}
+}
+
+template<int N, bool GAPLESS> __attribute__((target("avx2")))
+void Scanner::quantized_cols(const int n) {
+	int woff[N], coff[N];
+	for(int k = 0; k < N; k++) {
+		woff[k] = GAPLESS ? k : cols[k];
+		coff[k] = GAPLESS ? N - 1 - k : width - 1 - cols[k];
+	}
+	const __m128i* wt = (const __m128i*) &wqrows[0];
+	const __m128i* ct = (const __m128i*) &cqrows[0];
+	const uint16_t* sh = &shuffles[0];
+	for(int i = 0; i < n; i += 16) {
+		__m256i w = _mm256_setzero_si256(), v = _mm256_setzero_si256();
+#pragma GCC unroll 32
+		for(int k = 0; k < N; k++) {
+			w = _mm256_adds_epi16(w, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(wt + k)),
+					_mm256_loadu_si256((const __m256i*) (sh + woff[k] + i))));
+			v = _mm256_adds_epi16(v, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(ct + k)),
+					_mm256_loadu_si256((const __m256i*) (sh + coff[k] + i))));
+		}
+		_mm256_storeu_si256((__m256i*) &wqsum[i], w);
+		_mm256_storeu_si256((__m256i*) &cqsum[i], v);
+	}
+}
+
+template<int N, bool GAPLESS> void Scanner::window_cols(const int i) {
+	const unsigned char* c = &codes[i];
+	double w = 0.0, v = 0.0;
+#pragma GCC unroll 32
+	for(int k = 0; k < N; k++) {
+		w += wrows[4 * k + c[GAPLESS ? k : cols[k]]];
+		v += crows[4 * k + c[GAPLESS ? N - 1 - k : width - 1 - cols[k]]];
+	}
+	wsum[i] = w;
+	csum[i] = v;
+}
+
+int Scanner::screen_scalar(const int n, const double cut) {
+	const double qinv = 1 / qscale;
+	int np = 0;
+	for(int i = 0; i < n; i++)
+		if(wqsum[i] * qinv + qerror - wbg[i] >= cut || cqsum[i] * qinv + qerror - cbg[i] >= cut)
+			passed[np++] = i;
+	return np;
+}
+
+// With the background folded in, the bound on a sum is the same for every
+// window, so 16 quantized sums are compared at once against the largest
+// whole number surely below it. Otherwise the bounds are found as in
+// screen_scalar(), four at a time.
+__attribute__((target("avx2")))
+int Scanner::screen_avx2(const int n, const double cut) {
+	const double qinv = 1 / qscale;
+	int np = 0;
+	if(bgmodel.folded()) {
+		const double t = floor((cut - qerror) * qscale) - 1;
+		if(t < -32767) {
+			for(int i = 0; i < n; i++)
+				passed[np++] = i;
+			return np;
+		}
+		const __m256i least = _mm256_set1_epi16((int16_t) min(t, 32767.0));
+		for(int i = 0; i < n; i += 16) {
+			__m256i below = _mm256_and_si256(_mm256_cmpgt_epi16(least, _mm256_loadu_si256((const __m256i*) &wqsum[i])),
+					_mm256_cmpgt_epi16(least, _mm256_loadu_si256((const __m256i*) &cqsum[i])));
+			unsigned int m = ~_mm256_movemask_epi8(below) & 0x55555555;   // one bit per window
+			if(n - i < 16) m &= (1U << (2 * (n - i))) - 1;
+			for(; m != 0; m &= m - 1)
+				passed[np++] = i + (__builtin_ctz(m) >> 1);
+		}
+		return np;
+	}
+	const __m256d vqinv = _mm256_set1_pd(qinv), vqerror = _mm256_set1_pd(qerror), vcut = _mm256_set1_pd(cut);
+	for(int i = 0; i < n; i += 4) {
+		__m256d w = _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*) &wqsum[i])));
+		__m256d c = _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*) &cqsum[i])));
+		w = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(w, vqinv), vqerror), _mm256_loadu_pd(&wbg[i]));
+		c = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(c, vqinv), vqerror), _mm256_loadu_pd(&cbg[i]));
+		unsigned int m = _mm256_movemask_pd(_mm256_or_pd(_mm256_cmp_pd(w, vcut, _CMP_GE_OQ), _mm256_cmp_pd(c, vcut, _CMP_GE_OQ)));
+		if(n - i < 4) m &= (1U << (n - i)) - 1;
+		for(; m != 0; m &= m - 1)
+			passed[np++] = i + __builtin_ctz(m);
+	}
+	return np;
+}
+
+void Scanner::background_scalar(const long gp, const int n) {
+	if(bgmodel.folded()) return;                                  // wbg and cbg stay 0
+	for(int i = 0; i < n; i++) {
+		wbg[i] = bgmodel.score_site(runs, width, gp + i, 1);
+		cbg[i] = bgmodel.score_site(runs, width, gp + i, 0);
+	}
+}
+
+// The running sums of consecutive windows are consecutive, so each run
+// costs two unaligned loads per strand for four windows.
+__attribute__((target("avx2")))
+void Scanner::background_avx2(const long gp, const int n) {
+	if(bgmodel.folded()) return;
+	if(! bgmodel.has_scores()) {
+		background_scalar(gp, n);
+		return;
+	}
+	const double* wcumul = bgmodel.watson_cumul();
+	const double* ccumul = bgmodel.crick_cumul();
+	vector<pair<int, int> >::const_iterator ri, re = runs.end();
+	int i;
+	for(i = 0; i + 4 <= n; i += 4) {
+		__m256d bw = _mm256_setzero_pd(), bc = _mm256_setzero_pd();
+		const double* wp = wcumul + gp + i;
+		for(ri = runs.begin(); ri != re; ++ri)
+			bw = _mm256_add_pd(bw, _mm256_sub_pd(_mm256_loadu_pd(wp + ri->second), _mm256_loadu_pd(wp + ri->first)));
+		const double* cp = ccumul + gp + i + width;
+		for(ri = runs.begin(); ri != re; ++ri)
+			bc = _mm256_add_pd(bc, _mm256_sub_pd(_mm256_loadu_pd(cp - ri->first), _mm256_loadu_pd(cp - ri->second)));
+		_mm256_storeu_pd(&wbg[i], bw);
+		_mm256_storeu_pd(&cbg[i], bc);
+	}
+	for(; i < n; i++) {
+		wbg[i] = bgmodel.score_site(runs, width, gp + i, 1);
+		cbg[i] = bgmodel.score_site(runs, width, gp + i, 0);
+	}
+}
+
+void Scanner::ratios_scalar(const int n, double* Lw, double* Lc) {
+	for(int i = 0; i < n; i++) {
+		Lw[i] = fastexp(wsum[i] - wbg[i]);
+		Lc[i] = fastexp(csum[i] - cbg[i]);
+	}
+}
+
+// fastexp(): the truncated integer becomes the high word of the result
+__attribute__((target("avx2")))
+void Scanner::ratios_avx2(const int n, double* Lw, double* Lc) {
+	const __m256d scale = _mm256_set1_pd(1512775), shift = _mm256_set1_pd(1072632447);
+	int i;
+	for(i = 0; i + 4 <= n; i += 4) {
+		__m256d w = _mm256_sub_pd(_mm256_loadu_pd(&wsum[i]), _mm256_loadu_pd(&wbg[i]));
+		__m256d c = _mm256_sub_pd(_mm256_loadu_pd(&csum[i]), _mm256_loadu_pd(&cbg[i]));
+		__m128i wi = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_mul_pd(w, scale), shift));
+		__m128i ci = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_mul_pd(c, scale), shift));
+		_mm256_storeu_pd(Lw + i, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_cvtepi32_epi64(wi), 32)));
+		_mm256_storeu_pd(Lc + i, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_cvtepi32_epi64(ci), 32)));
+	}
+	for(; i < n; i++) {
+		Lw[i] = fastexp(wsum[i] - wbg[i]);
+		Lc[i] = fastexp(csum[i] - cbg[i]);
+	}
+}
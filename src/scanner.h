@@ -0,0 +1,79 @@
+#ifndef _scanner
+#define _scanner
+
+#include "standard.h"
+#include "seqset.h"
+#include "bgmodel.h"
+
+// Scores blocks of consecutive windows on both strands at once, giving for
+// each the sum of the score matrix over the motif columns, less
+// BGModel::score_site(), as a likelihood ratio. Uses AVX2 or SSE4.1 when the
+// CPU has them.
+class Scanner {
+	const Seqset& seqset;
+	const BGModel& bgmodel;
+	int width;
+	int ncols;
+	vector<int> cols;                                             // motif columns
+	vector<pair<int, int> > runs;                                 // runs of consecutive columns, for background scores
+	vector<double> wrows;                                         // score matrix, four entries per column
+	vector<double> crows;                                         // the same with bases complemented, for the Crick strand
+	vector<int16_t> wqrows;                                       // wrows times qscale, rounded, eight entries per column
+	vector<int16_t> cqrows;                                       // (the four repeated) to fill a shuffle table
+	double qscale;                                                // chosen so that no sum of quantized columns overflows
+	double qerror;                                                // most a quantized sum can be off from the exact one
+	vector<unsigned char> codes;                                  // bases of the block being scored
+	vector<uint16_t> shuffles;                                    // byte pairs picking the entry for each base from a row
+	vector<double> wsum;                                          // column sums of the block, by strand
+	vector<double> csum;
+	vector<int16_t> wqsum;                                        // quantized column sums
+	vector<int16_t> cqsum;
+	vector<double> wbg;                                           // background scores of the block
+	vector<double> cbg;
+	vector<int> passed;                                           // windows that might reach the least ratio asked for
+	static const int MAX_UNROLLED = 32;                           // most columns for kernels unrolled at compile time
+	bool avx2;                                                    // whether the unrolled block kernels can run
+	void (Scanner::*generic_sums)(const int n);                   // kernels for any matrix, chosen for the CPU
+	void (Scanner::*generic_quantized)(const int n);              // NULL without SSE4.1
+	void (Scanner::*sum_columns)(const int n);                    // kernels for the current matrix
+	void (Scanner::*sum_quantized)(const int n);
+	void (Scanner::*sum_window)(const int i);
+	int (Scanner::*screen)(const int n, const double cut);
+	void (Scanner::*sum_background)(const long gp, const int n);
+	void (Scanner::*find_ratios)(const int n, double* Lw, double* Lc);
+	void (Scanner::*unrolled_sums[2][MAX_UNROLLED + 1])(const int n);       // by whether the motif is gapless and
+	void (Scanner::*unrolled_quantized[2][MAX_UNROLLED + 1])(const int n);  // by number of columns
+	void (Scanner::*unrolled_window[2][MAX_UNROLLED + 1])(const int i);
+
+	void unpack(const long gp, const int n);                      // Fill codes with n bases from gp
+	void sum_scalar(const int n);                                 // Sum the columns of n windows into wsum and csum
+	void sum_sse4(const int n);
+	void sum_avx2(const int n);
+	void window_generic(const int i);                             // The same for window i alone
+	template<int N> void set_kernels();                           // Fill in the unrolled kernels for up to N columns
+	template<int N, bool GAPLESS> void sum_cols(const int n);     // The kernels for N columns, the same as the others
+	template<int N, bool GAPLESS> void quantized_cols(const int n);
+	template<int N, bool GAPLESS> void window_cols(const int i);
+	void quantized_sse4(const int n);                             // Sum the quantized columns into wqsum and cqsum
+	void quantized_avx2(const int n);
+	int screen_scalar(const int n, const double cut);            // List the windows whose quantized sums might give log
+	int screen_avx2(const int n, const double cut);              // ratios of cut or more, returning how many
+	void background_scalar(const long gp, const int n);           // Fill wbg and cbg
+	void background_avx2(const long gp, const int n);
+	void ratios_scalar(const int n, double* Lw, double* Lc);      // Exponentiate the sums less the background scores
+	void ratios_avx2(const int n, double* Lw, double* Lc);
+
+public:
+	static const int BLOCK = 256;                                 // most windows scored by one call
+	Scanner(const Seqset& s, const BGModel& bgm);
+	void set_matrix(const double* sm, vector<int>::const_iterator first_col, vector<int>::const_iterator last_col,
+			const int w, const vector<pair<int, int> >& col_runs);     // Use a score matrix from MotifSearch::calc_matrix()
+	void score(const long gp, const int n, double* Lw, double* Lc);   // Fill Lw and Lc with the likelihood ratios of
+	                                                                   // n windows starting at gp, for n <= BLOCK
+	void score(const long gp, const int n, double* Lw, double* Lc, const double Lmin);    // The same, but windows whose
+	                                                                   // ratios are surely both below Lmin may get 0
+	void log_ratios(const long gp, const int n, double* Xw, double* Xc);    // Fill Xw and Xc with the logs that
+	                                                                   // fastexp() turns into the ratios
+};
+
+#endif
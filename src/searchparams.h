@@ -11,7 +11,7 @@ struct SearchParams {
 	int maxlen;						           // maximum length of sites
 	int npass;
 	int minpass;
-	int nruns;
+	long nruns;
 	float minprob[4];                // minimum P(m|s) cutoff in each phase
 	bool fragment;
 	int seed;
@@ -21,6 +21,7 @@ struct SearchParams {
 	int oversample;
 	int minsize;
 	float mincorr;
+	int passthreads;                 // threads for single_pass and compute_seq_scores, drawing from a stream per sequence (0 for rand())
 };
 
 #endif
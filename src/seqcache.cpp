@@ -0,0 +1,294 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "seqcache.h"
+
+SeqCache::SeqCache() :
+header(NULL),
+offsets(NULL),
+words(NULL),
+runs(NULL),
+soft_runs(NULL),
+name_data(NULL),
+table_data(NULL),
+wbg(NULL),
+cbg(NULL),
+wcum(NULL),
+ccum(NULL),
+shm_fd(-1) {
+}
+
+bool SeqCache::file_stamp(const string& filename, long& size, long& mtime) {
+	struct stat st;
+	if(stat(filename.c_str(), &st) == -1) return false;
+	size = st.st_size;
+	mtime = st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+	return true;
+}
+
+// Sequences extracted with -ref come from the reference as much as from the
+// position list, so the reference and its index are stamped too
+bool SeqCache::source_stamp(const char* source, const char* ref, Header& h) {
+	h.ref_size = h.ref_mtime = h.fai_size = h.fai_mtime = 0;
+	if(! file_stamp(source, h.src_size, h.src_mtime)) return false;
+	if(ref == NULL) return true;
+	return file_stamp(ref, h.ref_size, h.ref_mtime) && file_stamp(string(ref) + ".fai", h.fai_size, h.fai_mtime);
+}
+
+long SeqCache::table_stamp(const string& tables) {
+	return 1 + crc32(crc32(0L, Z_NULL, 0), (const Bytef*) tables.data(), tables.length());
+}
+
+string SeqCache::shared_name(const string& name, const char* source, const char* ref, const int order,
+		const long bgstamp) {
+	Header h;
+	memset(&h, 0, sizeof(h));
+	source_stamp(source, ref, h);                   // missing files are left unstamped, and fail later anyway
+	const long stamp[] = { VERSION, order, bgstamp, h.src_size, h.src_mtime, h.ref_size, h.ref_mtime,
+			h.fai_size, h.fai_mtime };
+	ostringstream out;
+	out << name << '.' << order << '.' << hex << setw(8) << setfill('0')
+			<< crc32(crc32(0L, Z_NULL, 0), (const Bytef*) stamp, sizeof(stamp));
+	return out.str();
+}
+
+// Shared memory objects are listed under /dev/shm on Linux, without the leading '/'
+int SeqCache::remove_shared(const string& name) {
+	const string prefix = name.substr(name[0] == '/' ? 1 : 0) + ".";
+	DIR* dir = opendir("/dev/shm");
+	if(dir == NULL) return 0;
+	int n = 0;
+	struct dirent* ent;
+	while((ent = readdir(dir)) != NULL) {
+		if(strncmp(ent->d_name, prefix.c_str(), prefix.length()) != 0) continue;
+		const string obj = string("/") + ent->d_name;
+		if(shm_unlink(obj.c_str()) == 0) {
+			cerr << "\t\tRemoved shared memory '" << obj << "'\n";
+			n++;
+		}
+	}
+	closedir(dir);
+	return n;
+}
+
+bool SeqCache::open(const char* filename, const char* source, const char* ref, const int order, const long bgstamp) {
+	if(! map.open(filename)) return false;
+	if(! attach(source, ref, order, bgstamp)) {
+		map.close();
+		return false;
+	}
+	return true;
+}
+
+bool SeqCache::open_shared(const char* name, const char* source, const char* ref, const int order, bool& owner,
+		const long bgstamp) {
+	owner = false;
+	int empty = 0;
+	for(int wait = 0; wait < SHARED_WAIT; wait++) {
+		int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if(fd != -1) {
+			// Nobody has built it yet, so it is ours to fill; the reservation
+			// holds our pid until write_shared() fills it through the same fd
+			Header h;
+			memset(&h, 0, sizeof(h));
+			h.owner = getpid();
+			if(::write(fd, &h, sizeof(h)) != (ssize_t) sizeof(h)) {
+				::close(fd);
+				shm_unlink(name);
+				return false;
+			}
+			shm_fd = fd;
+			owner = true;
+			return false;
+		}
+		if(map.open_shared(name) && map.size() >= sizeof(Header)) {
+			empty = 0;
+			header = (const Header*) map.data();
+			if(memcmp(header->magic, "MSPCACHE", 8) == 0) {
+				if(attach(source, ref, order, bgstamp)) return true;
+				// Left over from other data; workers already attached keep their mapping
+				map.close();
+				shm_unlink(name);
+				continue;
+			}
+			if(kill(header->owner, 0) == -1 && errno == ESRCH) {
+				// The owner died before filling it, so take it over
+				cerr << "\t\tRemoving shared memory '" << name << "' left by process " << header->owner << "\n";
+				map.close();
+				shm_unlink(name);
+				continue;
+			}
+		} else if(++empty > EMPTY_WAIT) {
+			// Reserved, but the owner never got as far as writing its pid
+			map.close();
+			shm_unlink(name);
+			empty = 0;
+			continue;
+		}
+		map.close();
+		sleep(1);
+	}
+	cerr << "Gave up waiting for shared memory '" << name << "' to be filled\n";
+	return false;
+}
+
+bool SeqCache::attach(const char* source, const char* ref, const int order, const long bgstamp) {
+	if(map.size() < sizeof(Header)) return false;
+	header = (const Header*) map.data();
+	Header stamp;
+	if(memcmp(header->magic, "MSPCACHE", 8) != 0
+			|| header->version != VERSION
+			|| header->order != order
+			|| header->bg_stamp != bgstamp
+			|| ! source_stamp(source, ref, stamp)
+			|| header->src_size != stamp.src_size
+			|| header->src_mtime != stamp.src_mtime
+			|| header->ref_size != stamp.ref_size
+			|| header->ref_mtime != stamp.ref_mtime
+			|| header->fai_size != stamp.fai_size
+			|| header->fai_mtime != stamp.fai_mtime) {
+		return false;
+	}
+
+	long pos = aligned(sizeof(Header));
+	offsets = (const long*) (map.data() + pos);
+	pos += aligned((header->nseqs + 1) * sizeof(long));
+	words = (const uint64_t*) (map.data() + pos);
+	pos += aligned(header->nwords * sizeof(uint64_t));
+	runs = (const pair<long, long>*) (map.data() + pos);
+	pos += aligned(header->nambig * sizeof(pair<long, long>));
+	soft_runs = (const pair<long, long>*) (map.data() + pos);
+	pos += aligned(header->nsoft * sizeof(pair<long, long>));
+	name_data = map.data() + pos;
+	pos += aligned(header->names_len);
+	table_data = map.data() + pos;
+	pos += aligned(header->tables_len);
+	wbg = (const float*) (map.data() + pos);
+	pos += aligned(header->nscores * sizeof(float));
+	cbg = (const float*) (map.data() + pos);
+	pos += aligned(header->nscores * sizeof(float));
+	wcum = (const double*) (map.data() + pos);
+	pos += header->nscores > 0 ? (header->nscores + 1) * sizeof(double) : 0;
+	ccum = (const double*) (map.data() + pos);
+	pos += header->nscores > 0 ? (header->nscores + 1) * sizeof(double) : 0;
+	if((size_t) pos != map.size()) {
+		cerr << "Cached sequence data is truncated, ignoring it\n";
+		return false;
+	}
+	return true;
+}
+
+Seqset* SeqCache::seqset() const {
+	assert(map.is_open());
+	return new Seqset(header->nseqs, offsets, words, runs, header->nambig, soft_runs, header->nsoft);
+}
+
+BGModel* SeqCache::bgmodel(const Seqset& s, const bool lean) const {
+	assert(map.is_open());
+	istringstream tables(string(table_data, header->tables_len));
+	if(header->nscores > 0 && ! lean)
+		return new BGModel(s, tables, wbg, cbg, wcum, ccum);
+	return new BGModel(s, tables, lean);
+}
+
+void SeqCache::names(vector<string>& nameset) const {
+	assert(map.is_open());
+	const char* p = name_data;
+	for(long i = 0; i < header->nseqs; i++) {
+		nameset.push_back(string(p));
+		p += nameset.back().length() + 1;
+	}
+}
+
+bool SeqCache::write_to(FILE* out, const char* source, const char* ref, const Seqset& s,
+		const vector<string>& nameset, const BGModel& bgm, const long bgstamp, const bool scores) {
+	Header h;
+	memset(&h, 0, sizeof(h));
+	h.version = VERSION;
+	h.order = bgm.get_order();
+	h.bg_stamp = bgstamp;
+	h.nseqs = s.num_seqs();
+	h.total_len = s.total_len();
+	h.nwords = s.packed_words();
+	h.nambig = s.num_ambiguous_runs();
+	h.nsoft = s.num_soft_runs();
+	h.nscores = scores && bgm.has_scores() ? s.total_len() : 0;
+	h.owner = getpid();
+	if(! source_stamp(source, ref, h)) return false;
+
+	string names;
+	for(unsigned int i = 0; i < nameset.size(); i++) {
+		names.append(nameset[i]);
+		names.append(1, '\0');
+	}
+	h.names_len = names.length();
+	ostringstream tables;
+	bgm.write_tables(tables);
+	h.tables_len = tables.str().length();
+
+	// The magic is written last, so that readers never take a partial cache for a whole one
+	const char pad[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	fwrite(&h, sizeof(h), 1, out);
+	fwrite(pad, aligned(sizeof(h)) - sizeof(h), 1, out);
+	fwrite(s.offset_table(), sizeof(long), h.nseqs + 1, out);
+	fwrite(s.packed(), sizeof(uint64_t), h.nwords, out);
+	fwrite(s.ambiguous_runs(), sizeof(pair<long, long>), h.nambig, out);
+	fwrite(s.soft_runs(), sizeof(pair<long, long>), h.nsoft, out);
+	fwrite(names.data(), 1, h.names_len, out);
+	fwrite(pad, aligned(h.names_len) - h.names_len, 1, out);
+	fwrite(tables.str().data(), 1, h.tables_len, out);
+	fwrite(pad, aligned(h.tables_len) - h.tables_len, 1, out);
+	if(h.nscores > 0) {
+		const long n = h.nscores;
+		const long npad = aligned(n * sizeof(float)) - n * sizeof(float);
+		fwrite(bgm.watson_scores(), sizeof(float), n, out);
+		fwrite(pad, npad, 1, out);
+		fwrite(bgm.crick_scores(), sizeof(float), n, out);
+		fwrite(pad, npad, 1, out);
+		fwrite(bgm.watson_cumul(), sizeof(double), n + 1, out);
+		fwrite(bgm.crick_cumul(), sizeof(double), n + 1, out);
+	}
+	if(fflush(out) != 0 || ferror(out)) return false;
+	if(fseek(out, 0, SEEK_SET) != 0) return false;
+	fwrite("MSPCACHE", 8, 1, out);
+	return fflush(out) == 0 && ! ferror(out);
+}
+
+bool SeqCache::write(const char* filename, const char* source, const char* ref, const Seqset& s,
+		const vector<string>& nameset, const BGModel& bgm, const long bgstamp) {
+	// Write to a temporary file and rename, so that readers never see a partial cache
+	stringstream tmpstr;
+	tmpstr << filename << '.' << getpid() << ".tmp";
+	FILE* out = fopen(tmpstr.str().c_str(), "wb");
+	if(out == NULL) return false;
+	bool ok = write_to(out, source, ref, s, nameset, bgm, bgstamp, false);
+	ok = (fclose(out) == 0) && ok;
+	if(! ok || rename(tmpstr.str().c_str(), filename) != 0) {
+		remove(tmpstr.str().c_str());
+		return false;
+	}
+	return true;
+}
+
+bool SeqCache::write_shared(const char* name, const char* source, const char* ref, const Seqset& s,
+		const vector<string>& nameset, const BGModel& bgm, const long bgstamp) {
+	// Write through the reserved fd rather than by name, in case a waiter took
+	// us for dead and the name now belongs to another object
+	int fd = shm_fd;
+	shm_fd = -1;
+	if(fd == -1) return false;
+	FILE* out = lseek(fd, 0, SEEK_SET) == 0 ? fdopen(fd, "wb") : NULL;
+	if(out == NULL) {
+		::close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	bool ok = write_to(out, source, ref, s, nameset, bgm, bgstamp, true);
+	ok = (fclose(out) == 0) && ok;
+	if(! ok) shm_unlink(name);
+	return ok;
+}
@@ -0,0 +1,88 @@
+#ifndef _seqcache
+#define _seqcache
+
+#include "seqset.h"
+#include "bgmodel.h"
+#include "mappedfile.h"
+
+// Binary cache of an encoded sequence set, its names and its trained background tables.
+// The cache is mapped read-only, so every worker on a host shares the same pages.
+// A cache can also live in a POSIX shared memory object, which then also holds the
+// background scores for every position and their running sums, so that workers need no
+// private copy of them. A shared object outlives the processes that use it, so that
+// later runs attach without rebuilding it, until remove_shared() unlinks it or the host
+// reboots; its name carries the order and a stamp of the inputs, so that workers given
+// different data build their own objects instead of replacing each other's.
+class SeqCache {
+	struct Header {
+		char magic[8];                         // set last, once the rest has been written
+		int version;
+		int order;                             // order of the stored background tables
+		long nseqs;
+		long total_len;                        // total number of bases
+		long nwords;                           // number of packed words
+		long nambig;                           // number of ambiguous runs
+		long nsoft;                            // number of lowercase runs
+		long names_len;                        // bytes of NUL-terminated names
+		long tables_len;                       // bytes of background tables
+		long nscores;                          // background scores per strand, 0 if not stored
+		long src_size;                         // size and modification time, in nanoseconds, of the FASTA file
+		long src_mtime;                        // or position list
+		long ref_size;                         // the same for the reference the positions were extracted
+		long ref_mtime;                        // from and its index, or 0 without one
+		long fai_size;
+		long fai_mtime;
+		long bg_stamp;                         // table_stamp() of background tables trained on other
+		                                       // sequences, or 0 if they were trained on these
+		long owner;                            // pid of the process that reserved a shared cache, so that
+		                                       // waiters can tell when it died before filling it
+	};
+
+	MappedFile map;
+	const Header* header;
+	const long* offsets;
+	const uint64_t* words;
+	const pair<long, long>* runs;
+	const pair<long, long>* soft_runs;
+	const char* name_data;
+	const char* table_data;
+	const float* wbg;
+	const float* cbg;
+	const double* wcum;
+	const double* ccum;
+	int shm_fd;                               // shared memory object reserved by open_shared(), until filled
+
+	static const int VERSION = 7;
+	static const int SHARED_WAIT = 600;       // seconds to wait for another process to fill a shared cache
+	static const int EMPTY_WAIT = 10;         // seconds a reserved object may stay too small to name its owner
+	static long aligned(const long n) { return (n + 7) & ~7L; }
+	static bool file_stamp(const string& filename, long& size, long& mtime);
+	static bool source_stamp(const char* source, const char* ref, Header& h);   // Stamp the input files, ref may be NULL
+	bool attach(const char* source, const char* ref, const int order, const long bgstamp);   // Check the mapped header and
+	                                                                                          // find the sections
+	static bool write_to(FILE* out, const char* source, const char* ref, const Seqset& s,
+			const vector<string>& nameset, const BGModel& bgm, const long bgstamp, const bool scores);
+
+public:
+	SeqCache();
+	bool open(const char* filename, const char* source, const char* ref, const int order, const long bgstamp = 0);
+	                                                                         // Map a cache, false if missing or stale
+	bool open_shared(const char* name, const char* source, const char* ref, const int order, bool& owner,
+			const long bgstamp = 0);
+	                                                                         // Map a shared cache; when there is none, reserve
+	                                                                         // it and set owner, and the caller should fill it
+	Seqset* seqset() const;                                                  // Return a new Seqset viewing the mapped bases
+	BGModel* bgmodel(const Seqset& s, const bool lean = false) const;       // Return a new BGModel for the mapped set
+	void names(vector<string>& nameset) const;                               // Return the sequence names
+	static bool write(const char* filename, const char* source, const char* ref, const Seqset& s,
+			const vector<string>& nameset, const BGModel& bgm, const long bgstamp = 0);
+	bool write_shared(const char* name, const char* source, const char* ref, const Seqset& s,
+			const vector<string>& nameset, const BGModel& bgm, const long bgstamp = 0);   // Fill the shared cache reserved by open_shared
+	static long table_stamp(const string& tables);                          // Checksum identifying background tables
+	static string shared_name(const string& name, const char* source, const char* ref, const int order,
+			const long bgstamp = 0);                                         // Name of the shared cache for this data
+	static int remove_shared(const string& name);                           // Unlink the shared caches for any data made
+	                                                                         // under a name, returning how many there were
+};
+
+#endif
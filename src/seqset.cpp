@@ -3,26 +3,315 @@
 
 #include "seqset.h"
 
-Seqset::Seqset() : 
-nseqs(0),
-seqs(nseqs),
-seq_lens(nseqs) {
-}
+// 0-3 for ACGT, 4 for other letters, 5 for characters that are skipped
+static char nt[256];
+static bool nt_init = false;
 
-Seqset::Seqset(const vector<string>& v) :
-nseqs(v.size()),
-seqs(nseqs),
-seq_lens(nseqs) {
-	map<char, char> nt;
+static void init_nt() {
+	memset(nt, 4, 256);
 	nt['A'] = nt['a'] = 0;
 	nt['C'] = nt['c'] = 1;
 	nt['G'] = nt['g'] = 2;
 	nt['T'] = nt['t'] = 3;
-	for(int i = 0; i < nseqs; i++) {
-		seq_lens[i] = v[i].length();
-		seqs[i].reserve(seq_lens[i]);
-		for(int j = 0; j < seq_lens[i]; j++) {
-			seqs[i].push_back(nt[v[i][j]]);
+	nt[' '] = nt['\t'] = nt['\r'] = nt['\n'] = nt['\v'] = nt['\f'] = 5;
+	nt_init = true;
+}
+
+Seqset::Seqset() :
+nseqs(0),
+seq_store(2, 0),
+offset_store(1, 0),
+fill(0),
+run_start(-1),
+soft_start(-1) {
+	seqs = &seq_store[0];
+	offsets = &offset_store[0];
+	ends = offsets + 1;
+	length = 0;
+	ambig = NULL;
+	nambig = 0;
+	soft = NULL;
+	nsoft = 0;
+}
+
+Seqset::Seqset(const vector<string>& v) :
+nseqs(0),
+seq_store(2, 0),
+offset_store(1, 0),
+fill(0),
+run_start(-1),
+soft_start(-1) {
+	seqs = &seq_store[0];
+	offsets = &offset_store[0];
+	ends = offsets + 1;
+	length = 0;
+	ambig = NULL;
+	nambig = 0;
+	soft = NULL;
+	nsoft = 0;
+	long total = 0;
+	for(unsigned int i = 0; i < v.size(); i++)
+		total += v[i].length();
+	reserve(total);
+	for(unsigned int i = 0; i < v.size(); i++) {
+		append(v[i].data(), v[i].length());
+		end_seq();
+	}
+}
+
+Seqset::Seqset(const int n, const long* offs, const uint64_t* words, const pair<long, long>* runs, const long nruns,
+		const pair<long, long>* lower, const long nlower) :
+nseqs(n),
+seqs(words),
+offsets(offs),
+ends(offs + 1),
+length(offs[n]),
+ambig(runs),
+nambig(nruns),
+soft(lower),
+nsoft(nlower),
+fill(-1),
+run_start(-1),
+soft_start(-1) {
+}
+
+Seqset::Seqset(const Seqset& s, const int window, const int overlap) :
+nseqs(0),
+seqs(s.seqs),
+length(s.length),
+ambig(s.ambig),
+nambig(s.nambig),
+soft(s.soft),
+nsoft(s.nsoft),
+fill(-1),
+run_start(-1),
+soft_start(-1) {
+	assert(overlap < window);
+	for(int c = 0; c < s.num_seqs(); c++) {
+		long start = s.offsets[c];
+		long end = s.ends[c];
+		if(end - start <= window) {
+			offset_store.push_back(start);
+			end_store.push_back(end);
+			origin.push_back(make_pair(c, 0L));
+			continue;
+		}
+		for(long p = start; ; p += window - overlap) {
+			offset_store.push_back(p);
+			end_store.push_back(min(p + window, end));
+			origin.push_back(make_pair(c, p - start));
+			if(p + window >= end) break;
+		}
+	}
+	nseqs = offset_store.size();
+	offset_store.push_back(length);
+	offsets = &offset_store[0];
+	ends = nseqs > 0 ? &end_store[0] : offsets + 1;
+}
+
+// Windows of a sequence are consecutive and in order, so the last one starting
+// at or before pp is found by binary search. The one before it is the only
+// other that may hold the bases too, and is taken if it scans that start.
+bool Seqset::find_window(const int pc, const long pp, const int w, int& c, int& p) const {
+	if(origin.empty()) {
+		c = pc;
+		p = pp;
+		return pc >= 0 && pc < nseqs && pp >= 0 && pp + w <= len_seq(pc);
+	}
+	int i = upper_bound(origin.begin(), origin.end(), make_pair(pc, pp)) - origin.begin() - 1;
+	if(i < 0 || origin[i].first != pc) return false;
+	if(i > 0 && origin[i - 1].first == pc && pp - origin[i - 1].second + w < len_seq(i - 1)) i--;
+	if(pp - origin[i].second + w > len_seq(i)) return false;
+	c = i;
+	p = pp - origin[i].second;
+	return true;
+}
+
+// Scans take starts up to the length less w, less one, so starts before the
+// returned position are ones the previous window of the sequence scans too
+int Seqset::first_new_start(const int c, const int w) const {
+	if(origin.empty() || c == 0 || origin[c - 1].first != origin[c].first) return 0;
+	return max(0L, ends[c - 1] - offsets[c] - w);
+}
+
+long Seqset::max_len() const {
+	long ret = 0;
+	for(int i = 0; i < nseqs; i++)
+		ret = max(ret, ends[i] - offsets[i]);
+	return ret;
+}
+
+void Seqset::reserve(const long n) {
+	seq_store.reserve(((fill + n) >> 5) + 3);
+}
+
+void Seqset::put_base(const uint64_t code) {
+	// Keep one spare word beyond the last base for word_at()
+	if((unsigned long) (fill >> 5) + 2 >= seq_store.size())
+		seq_store.push_back(0);
+	seq_store[fill >> 5] |= code << ((fill & 31) << 1);
+	fill++;
+}
+
+void Seqset::put_word(const uint64_t w) {
+	if((unsigned long) (fill >> 5) + 2 >= seq_store.size())
+		seq_store.push_back(0);
+	int sh = (fill & 31) << 1;
+	seq_store[fill >> 5] |= w << sh;
+	seq_store[(fill >> 5) + 1] |= (w >> 1) >> (63 - sh);
+	fill += 32;
+}
+
+void Seqset::close_run(long& start, vector<pair<long, long> >& runs) {
+	if(start >= 0) {
+		runs.push_back(make_pair(start, fill));
+		start = -1;
+	}
+}
+
+void Seqset::append(const char* s, const long n) {
+	assert(fill >= 0);
+	if(! nt_init) init_nt();
+	const unsigned char* u = (const unsigned char*) s;
+	long i = 0;
+	while(i < n) {
+		// Blocks of 32 plain bases are checked and packed without branches.
+		// Bit 1 of the ASCII code separates A/C from G/T, and xor with bit 2
+		// then gives 0-3 in ACGT order for both cases.
+		if(n - i >= 32) {
+			int bad = 0;
+			int lower = 0;
+			for(int k = 0; k < 32; k++) {
+				unsigned char c = u[i + k] & 0xDF;
+				bad |= (c != 'A') & (c != 'C') & (c != 'G') & (c != 'T');
+				lower += (u[i + k] >> 5) & 1;
+			}
+			if(! bad && (lower == 0 || lower == 32)) {
+				uint64_t w = 0;
+				for(int k = 0; k < 32; k++) {
+					uint64_t x = (u[i + k] >> 1) & 3;
+					w |= (x ^ (x >> 1)) << (k << 1);
+				}
+				close_run(run_start, ambig_store);
+				if(lower == 0)
+					close_run(soft_start, soft_store);
+				else if(soft_start < 0)
+					soft_start = fill;
+				put_word(w);
+				i += 32;
+				continue;
+			}
+		}
+		// Otherwise go one character at a time up to the end of the block
+		long stop = min(n, i + 32);
+		for(; i < stop; i++) {
+			char code = nt[u[i]];
+			if(code == 5) continue;
+			if(code == 4) {
+				if(run_start < 0) run_start = fill;
+				code = 0;
+			} else {
+				close_run(run_start, ambig_store);
+			}
+			if(u[i] >= 'a' && u[i] <= 'z') {
+				if(soft_start < 0) soft_start = fill;
+			} else {
+				close_run(soft_start, soft_store);
+			}
+			put_base(code);
+		}
+	}
+}
+
+void Seqset::end_seq() {
+	assert(fill >= 0);
+	close_run(run_start, ambig_store);
+	close_run(soft_start, soft_store);
+	offset_store.push_back(fill);
+	nseqs++;
+	seqs = &seq_store[0];
+	offsets = &offset_store[0];
+	ends = offsets + 1;
+	length = fill;
+	nambig = ambig_store.size();
+	ambig = nambig > 0 ? &ambig_store[0] : NULL;
+	nsoft = soft_store.size();
+	soft = nsoft > 0 ? &soft_store[0] : NULL;
+}
+
+void Seqset::unpack(const int c, const int p, const int n, char* out) const {
+	assert(p >= 0 && p + n <= len_seq(c));
+	long gp = offsets[c] + p;
+	int j = 0;
+	// Decode a whole word at a time, then finish off the tail
+	for(; j + 32 <= n; j += 32) {
+		uint64_t w = word_at(gp + j);
+		for(int k = 0; k < 32; k++, w >>= 2)
+			out[j + k] = w & 3;
+	}
+	if(j < n) {
+		uint64_t w = word_at(gp + j);
+		for(; j < n; j++, w >>= 2)
+			out[j] = w & 3;
+	}
+}
+
+bool Seqset::is_ambiguous(const int c, const int p) const {
+	long gp = offsets[c] + p;
+	const pair<long, long>* ai = upper_bound(ambig, ambig + nambig, make_pair(gp, LONG_MAX));
+	if(ai == ambig) return false;
+	--ai;
+	return gp < ai->second;
+}
+
+static bool run_end_before(const pair<long, long>& r, const long gp) { return r.second <= gp; }
+
+void Seqset::set_mask(const bool softmask) {
+	// Merge both kinds of run into one sorted list of disjoint runs
+	vector<pair<long, long> > all(ambig, ambig + nambig);
+	if(softmask) {
+		all.insert(all.end(), soft, soft + nsoft);
+		sort(all.begin(), all.end());
+	}
+	mask.clear();
+	for(unsigned long i = 0; i < all.size(); i++) {
+		if(! mask.empty() && all[i].first <= mask.back().second)
+			mask.back().second = max(mask.back().second, all[i].second);
+		else
+			mask.push_back(all[i]);
+	}
+	// Runs may reach past either end of a sequence, which scanning allows for
+	mask_first.resize(nseqs);
+	mask_last.resize(nseqs);
+	for(int c = 0; c < nseqs; c++) {
+		mask_first[c] = lower_bound(mask.begin(), mask.end(), offsets[c], run_end_before) - mask.begin();
+		mask_last[c] = mask_first[c];
+		while(mask_last[c] < (long) mask.size() && mask[mask_last[c]].first < ends[c])
+			mask_last[c]++;
+	}
+}
+
+bool Seqset::is_masked(const int c, const int p, const int w) const {
+	if(mask_first.empty()) return false;
+	long gp = offsets[c] + p;
+	// First run starting after the window start; the one before may cover it
+	const pair<long, long>* mi = upper_bound(mask_begin(c), mask_end(c), make_pair(gp, LONG_MAX));
+	if(mi != mask_begin(c) && (mi - 1)->second > gp) return true;
+	return mi != mask_end(c) && mi->first < gp + w;
+}
+
+int Seqset::masked_starts(const int c, const int w, const int from) const {
+	if(mask_first.empty()) return 0;
+	long last = len_seq(c) - w;                  // last window start
+	long done = from - 1;                        // starts up to here are counted
+	int ret = 0;
+	for(const pair<long, long>* mi = mask_begin(c); mi != mask_end(c); ++mi) {
+		long lo = max(mi->first - offsets[c] - w + 1, done + 1);
+		long hi = min(mi->second - offsets[c] - 1, last);
+		if(hi >= lo) {
+			ret += hi - lo + 1;
+			done = hi;
 		}
 	}
+	return ret;
 }
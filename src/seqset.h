@@ -3,19 +3,93 @@
 
 #ifndef _seqset
 #define _seqset
+#include <stdint.h>
 #include "standard.h"
 
 class Seqset{
 	int nseqs;
-	vector<vector <char> > seqs;
-	vector<int> seq_lens;
-	
+	const uint64_t* seqs;                        // all bases in one buffer, 2-bit encoded, 32 per word, low bits first
+	const long* offsets;                         // global position of the first base of each sequence, plus the total
+	const long* ends;                            // global position after the last base of each sequence
+	long length;                                 // number of bases in the buffer
+	const pair<long, long>* ambig;               // runs [start, end) of ambiguous (non-ACGT) bases, encoded as A
+	long nambig;                                 // number of ambiguous runs
+	const pair<long, long>* soft;                // runs [start, end) of lowercase (soft-masked) bases
+	long nsoft;
+	vector<uint64_t> seq_store;                  // storage for the above when not a view of external memory
+	vector<long> offset_store;
+	vector<long> end_store;
+	vector<pair<long, long> > ambig_store;
+	vector<pair<long, long> > soft_store;
+	vector<pair<int, long> > origin;             // sequence each window was split from and where in it the window starts,
+	                                             // empty when not split
+	vector<pair<long, long> > mask;              // merged runs of masked bases
+	vector<long> mask_first;                     // index of the first mask run touching each sequence
+	vector<long> mask_last;                      // index after the last one
+	long fill;                                   // number of bases appended so far
+	long run_start;                              // start of the open ambiguous run, or -1
+	long soft_start;                             // start of the open lowercase run, or -1
+
+	void put_base(const uint64_t code);          // Append one encoded base
+	void put_word(const uint64_t w);             // Append 32 encoded bases
+	void close_run(long& start, vector<pair<long, long> >& runs);   // Close an open run, if any
+
+	Seqset(const Seqset&);
+	Seqset& operator= (const Seqset&);
+
 public:
 	Seqset();
 	Seqset(const vector<string>& v);
-	int num_seqs() const { return nseqs; }                     // Return number of sequences in this set
-	int len_seq(const int i) const { return seq_lens[i]; }     // Return length of a specified sequence
-	vector<vector<char> > const& seq() const { return seqs; }   // Return reference to sequence data
+	Seqset(const int n, const long* offs, const uint64_t* words, const pair<long, long>* runs, const long nruns,
+			const pair<long, long>* lower, const long nlower);
+	Seqset(const Seqset& s, const int window, const int overlap);          // Split sequences longer than window into windows
+	                                                                       // overlapping by overlap bases, sharing the bases of s
+	void reserve(const long n);                                            // Reserve space for n more bases
+	void append(const char* s, const long n);                              // Encode text and add it to the sequence being built
+	void end_seq();                                                        // Finish the sequence being built
+	long building_len() const { return fill - length; }                    // Return number of bases in the sequence being built
+	int num_seqs() const { return nseqs; }                                 // Return number of sequences in this set
+	int len_seq(const int i) const { return ends[i] - offsets[i]; }        // Return length of a specified sequence
+	long offset(const int i) const { return offsets[i]; }                  // Return global position of a sequence start
+	long total_len() const { return length; }                              // Return total number of bases in the buffer
+	long max_len() const;                                                  // Return length of the longest sequence
+	int parent(const int c) const { return origin.empty() ? c : origin[c].first; }   // Return the sequence a window was split from
+	long parent_pos(const int c, const int p) const {                      // Return a position of a window in that sequence
+		return origin.empty() ? p : origin[c].second + p;
+	}
+	bool find_window(const int pc, const long pp, const int w, int& c, int& p) const;   // Find the first window holding w bases
+	                                                                       // at pp in sequence pc, false if none does
+	int first_new_start(const int c, const int w) const;                   // Return the first start of w bases that the
+	                                                                       // previous window of the same sequence does not scan
+	char base_at(const long gp) const {                                    // Return the base code (0-3) at a global position
+		return (seqs[gp >> 5] >> ((gp & 31) << 1)) & 3;
+	}
+	uint64_t word_at(const long gp) const {                                // Return the 32 bases starting at a global position
+		int sh = (gp & 31) << 1;
+		const uint64_t* w = &seqs[gp >> 5];
+		return (w[0] >> sh) | ((w[1] << 1) << (63 - sh));
+	}
+	char base(const int c, const int p) const { return base_at(offsets[c] + p); }
+	uint64_t word(const int c, const int p) const { return word_at(offsets[c] + p); }
+	void unpack(const int c, const int p, const int n, char* out) const;    // Decode n bases starting at p
+	bool is_ambiguous(const int c, const int p) const;                      // Return whether a base was not ACGT
+	long num_ambiguous_runs() const { return nambig; }
+	const pair<long, long>* ambiguous_runs() const { return ambig; }
+	long num_soft_runs() const { return nsoft; }
+	const pair<long, long>* soft_runs() const { return soft; }
+	void set_mask(const bool softmask);                                     // Mask ambiguous bases, and lowercase ones if softmask
+	const pair<long, long>* mask_begin(const int c) const {                 // Return the mask runs of a sequence, in global positions
+		return mask.empty() ? NULL : &mask[0] + mask_first[c];
+	}
+	const pair<long, long>* mask_end(const int c) const {
+		return mask.empty() ? NULL : &mask[0] + mask_last[c];
+	}
+	bool is_masked(const int c, const int p, const int w) const;            // Return whether a window of w bases touches the mask
+	int masked_starts(const int c, const int w, const int from = 0) const;  // Return number of window starts from from on
+	                                                                        // touching the mask
+	const long* offset_table() const { return offsets; }                    // Raw storage, for writing caches
+	const uint64_t* packed() const { return seqs; }
+	long packed_words() const { return (total_len() >> 5) + 2; }
 };
 
 #endif
@@ -86,6 +86,8 @@ void get_list(const char* filename, vector<string>& listset) {
 	}
 	string line;
 	while(getline(listfile, line)) {
+		if(! line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
 		if(line != "") {
 			listset.push_back(line);
 		}
@@ -351,7 +353,7 @@ double	lnfact(int n)
 /* static variables are guaranteed to be initialized to zero */
 {
 	static double lnft[MAX_LN_FACT];
-	assert(n < MAX_LN_FACT);
+	if (n >= MAX_LN_FACT) return stirlingln(n);
 
 	if (n <= 1) return 0.0;
 	if (n <= 50) return lnft[n] ? lnft[n] : (lnft[n] = gammaln(n + 1.0));